@@ -0,0 +1,276 @@
+/*
+ * matfile.h -- binary matrix files
+ *
+ * A matrix file is a struct matfile_header followed, at byte "offset", by
+ * the elements: "rows" rows of "ld" elements each, of which the first
+ * "cols" belong to the matrix (for a column-major file, "cols" columns of
+ * "ld" elements). The offset is a multiple of MATFILE_ALIGN, so a mapped
+ * payload is page aligned, and ld may include the writer's padding so the
+ * payload can be used in place. Fields and elements are in host byte
+ * order.
+ *
+ * matfile_write() cuts the payload into slices written concurrently with
+ * pwrite(). matfile_map() maps a file copy-on-write: the payload is used
+ * where it lies, and pages the program stores into are copied privately,
+ * never written back to the file.
+ *
+ * Shared by nxn-matrix and the mmult programs.
+ */
+
+#ifndef MATFILE_H
+#define MATFILE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define MATFILE_MAGIC "MATRIX\0\0"
+#define MATFILE_VERSION 1
+#define MATFILE_ALIGN 4096
+#define MATFILE_CHUNK (8 << 20)	/* bytes per pwrite() */
+
+enum matfile_type { MATFILE_DOUBLE, MATFILE_FLOAT, MATFILE_INT32, MATFILE_INT16, MATFILE_INT8, MATFILE_NTYPES };
+enum matfile_layout { MATFILE_ROW_MAJOR, MATFILE_COL_MAJOR };
+
+/*
+ * names as in mmult -T, and element sizes
+ */
+static const struct
+{
+	const char *name;
+	uint32_t size;
+} matfile_types[MATFILE_NTYPES] = {
+	{ "double", 8 }, { "float", 4 }, { "int32", 4 }, { "int16", 2 }, { "int8", 1 }
+};
+
+struct matfile_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t type;	/* enum matfile_type */
+	uint32_t layout;	/* enum matfile_layout */
+	uint32_t elem_size;	/* bytes per element */
+	uint64_t rows, cols;
+	uint64_t ld;	/* elements between the starts of consecutive rows (columns) */
+	uint64_t offset;	/* of the payload from the start of the file */
+};
+
+static inline void matfile_header_init(struct matfile_header *h, enum matfile_type type,
+                                       enum matfile_layout layout, uint64_t rows, uint64_t cols, uint64_t ld)
+{
+	memset(h, 0, sizeof(*h));
+	memcpy(h->magic, MATFILE_MAGIC, sizeof(h->magic));
+	h->version = MATFILE_VERSION;
+	h->type = type;
+	h->layout = layout;
+	h->elem_size = matfile_types[type].size;
+	h->rows = rows;
+	h->cols = cols;
+	h->ld = ld;
+	h->offset = MATFILE_ALIGN;
+}
+
+/*
+ * bytes of payload, padding included
+ */
+static inline size_t matfile_payload(const struct matfile_header *h)
+{
+	return (size_t)((h->layout == MATFILE_COL_MAJOR) ? h->cols : h->rows) * h->ld * h->elem_size;
+}
+
+/*
+ * check a header read from "file" of "size" bytes; prints what is wrong
+ * and returns -1, else 0
+ */
+static inline int matfile_check(const struct matfile_header *h, const char *file, size_t size)
+{
+	if (size < sizeof(*h) || memcmp(h->magic, MATFILE_MAGIC, sizeof(h->magic)) != 0) {
+		printf("%s: not a matrix file\n", file);
+		return -1;
+	}
+	if (h->version != MATFILE_VERSION) {
+		printf("%s: unsupported matrix file version %u\n", file, h->version);
+		return -1;
+	}
+	if (h->type >= MATFILE_NTYPES || h->elem_size != matfile_types[h->type].size ||
+	    h->layout > MATFILE_COL_MAJOR || h->offset < sizeof(*h) || h->offset % MATFILE_ALIGN != 0 ||
+	    h->ld < ((h->layout == MATFILE_COL_MAJOR) ? h->rows : h->cols)) {
+		printf("%s: corrupt matrix file header\n", file);
+		return -1;
+	}
+	// the programs index with int, and offset + payload must not wrap
+	if (h->rows > INT_MAX || h->cols > INT_MAX || h->offset > SIZE_MAX ||
+	    (((h->layout == MATFILE_COL_MAJOR) ? h->cols : h->rows) != 0 &&
+	     h->ld > (SIZE_MAX - h->offset) / h->elem_size / ((h->layout == MATFILE_COL_MAJOR) ? h->cols : h->rows))) {
+		printf("%s: matrix file header is too large\n", file);
+		return -1;
+	}
+	if (size < h->offset + matfile_payload(h)) {
+		printf("%s: truncated, %zu of %zu bytes present\n", file, size,
+		       (size_t)(h->offset + matfile_payload(h)));
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * read and check just the header of "file"; returns 0, or -1 after
+ * printing the problem
+ */
+static inline int matfile_read_header(const char *file, struct matfile_header *h)
+{
+	struct stat sb;
+	int fd, ok;
+
+	if ((fd = open(file, O_RDONLY)) < 0 || fstat(fd, &sb) != 0) {
+		printf("Cannot open %s for reading: %s\n", file, strerror(errno));
+		return -1;
+	}
+	memset(h, 0, sizeof(*h));
+	ok = pread(fd, h, sizeof(*h), 0) == sizeof(*h);
+	close(fd);
+	return matfile_check(h, file, ok ? sb.st_size : 0);
+}
+
+/*
+ * map "file" and return its payload, described by *h; the mapping (*map,
+ * *maplen) stays valid until the caller munmap()s it. Returns NULL after
+ * printing the problem.
+ */
+static inline void *matfile_map(const char *file, struct matfile_header *h, void **map, size_t *maplen)
+{
+	struct stat sb;
+	char *base;
+	int fd;
+
+	if ((fd = open(file, O_RDONLY)) < 0 || fstat(fd, &sb) != 0) {
+		printf("Cannot open %s for reading: %s\n", file, strerror(errno));
+		return NULL;
+	}
+	if (sb.st_size < sizeof(*h)) {
+		close(fd);
+		printf("%s: not a matrix file\n", file);
+		return NULL;
+	}
+	base = mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		printf("Cannot map %s: %s\n", file, strerror(errno));
+		return NULL;
+	}
+	memcpy(h, base, sizeof(*h));
+	if (matfile_check(h, file, sb.st_size) != 0) {
+		munmap(base, sb.st_size);
+		return NULL;
+	}
+	*map = base;
+	*maplen = sb.st_size;
+	return base + h->offset;
+}
+
+/*
+ * one writer's slice of the payload
+ */
+struct matfile_slice
+{
+	int fd;
+	const char *data;
+	size_t len;
+	off_t pos;
+	int err;
+	pthread_t tid;
+	int started;
+};
+
+static inline void *matfile_writer(void *arg)
+{
+	struct matfile_slice *s = arg;
+	size_t done = 0;
+	ssize_t n;
+
+	while (done < s->len) {
+		n = pwrite(s->fd, s->data + done, (s->len - done < MATFILE_CHUNK) ? s->len - done : MATFILE_CHUNK,
+		           s->pos + done);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			s->err = errno;
+			break;
+		}
+		if (n == 0) {
+			s->err = EIO;
+			break;
+		}
+		done += n;
+	}
+	return NULL;
+}
+
+/*
+ * write the header h and its payload "data" to "file", the payload split
+ * between up to nthreads concurrent writers (0 for one per online CPU).
+ * Returns 0, or -1 after printing the problem.
+ */
+static inline int matfile_write(const char *file, const struct matfile_header *h, const void *data, int nthreads)
+{
+	size_t len = matfile_payload(h);
+	size_t q, r, start;
+	struct matfile_slice *s;
+	int fd, t, err = 0;
+
+	if ((fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+		printf("Cannot open %s for writing: %s\n", file, strerror(errno));
+		return -1;
+	}
+	if (nthreads <= 0)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nthreads > len / MATFILE_CHUNK + 1)
+		nthreads = len / MATFILE_CHUNK + 1;
+	if (nthreads < 1)
+		nthreads = 1;
+	if ((s = calloc(nthreads, sizeof(*s))) == NULL)
+		err = ENOMEM;
+	else if (ftruncate(fd, h->offset + len) != 0 || pwrite(fd, h, sizeof(*h), 0) != sizeof(*h))
+		err = errno;
+	if (!err) {
+		// the first len % nthreads slices take one extra byte
+		q = len / nthreads;
+		r = len % nthreads;
+		for (t = 0, start = 0; t < nthreads; t++) {
+			s[t].fd = fd;
+			s[t].data = (const char *)data + start;
+			s[t].len = q + (t < r);
+			s[t].pos = h->offset + start;
+			start += s[t].len;
+		}
+		// the caller writes slice 0, and any slice whose thread did not start
+		for (t = 1; t < nthreads; t++)
+			s[t].started = pthread_create(&s[t].tid, NULL, matfile_writer, &s[t]) == 0;
+		for (t = 0; t < nthreads; t++)
+			if (!s[t].started)
+				matfile_writer(&s[t]);
+		for (t = 1; t < nthreads; t++)
+			if (s[t].started)
+				pthread_join(s[t].tid, NULL);
+		for (t = 0; !err && t < nthreads; t++)
+			err = s[t].err;
+	}
+	if (close(fd) != 0 && !err)
+		err = errno;
+	free(s);
+	if (err) {
+		printf("Cannot write %s: %s\n", file, strerror(err));
+		return -1;
+	}
+	return 0;
+}
+
+#endif
@@ -5,6 +5,10 @@
  * floating-point values from 0.0 to 0.999... and the computes the product
  * of A and B and then adds the result to C.
  *
+ * The elements are doubles, or with -T floats, 32-bit or 16-bit integers
+ * (random integers are 0 to 9). With -L the matrices are instead mapped
+ * from binary matrix files (see ../matfile.h), and -S saves them.
+ *
  * bnoble - Thu, Jan 26, 2017 12:05:11 PM
  *
  */
@@ -12,9 +16,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
-#include <windows.h> /* needed for QueryPerformanceFrequency() and QueryPerformanceFrequency() */
-
-#define _64bit (sizeof(void*) == 8)
+#include <string.h>
+#include <stdint.h>
+#include <malloc.h> /* memalign() */
+#include <time.h> /* clock_gettime() */
+#include <limits.h> /* PATH_MAX */
+#include "../matfile.h"
 
 /*
  * C-preprocessor macros
@@ -22,13 +29,64 @@
  */
 #define MIN(a,b) (((a)<(b))?(a):(b))
 
+/*
+ * Matrices
+ *   One page-aligned block per matrix, element (i,j) at data[i*ld + j].
+ *   The leading dimension ld pads each row to an odd number of cache lines
+ *   so that rows never start a multiple of 4 KB apart; at N = 512, 1024,
+ *   ... unpadded rows all fall in the same cache sets and walking down a
+ *   column of B evicts itself.
+ */
+#define LINE_SIZE 64
+
+struct matrix
+{
+	void *data;	/* of the -T element type */
+	int ld;	/* elements between the starts of consecutive rows */
+};
+
+/*
+ * Element types
+ *   X(name, element type, accumulator type, printf format, random value,
+ *     matrix file type)
+ *
+ *   The kernels are expanded once per entry (ELEMENT_KERNELS() below).
+ *   int16 products are summed in 32 bits and wrap when stored back into C.
+ */
+#define ELEMENT_TYPES(X) \
+	X(double, double, double, " %0.1e", drand48(), MATFILE_DOUBLE) \
+	X(float, float, float, " %0.1e", drand48(), MATFILE_FLOAT) \
+	X(int32, int32_t, int32_t, " %d", (int)(10.0 * drand48()), MATFILE_INT32) \
+	X(int16, int16_t, int32_t, " %d", (int)(10.0 * drand48()), MATFILE_INT16)
+
+/*
+ * Sizes with fully unrolled kernels of their own (FIXED_KERNEL() below)
+ */
+#define NFIXED 4
+static const int FixedSizes[NFIXED] = { 4, 8, 16, 32 };
+
+struct element_type
+{
+	const char *name;
+	enum matfile_type file_type;
+	void (*initialize)(void);
+	void (*simple)(void);
+	void (*block)(void);
+	void (*packed)(void);
+	void (*fixed[NFIXED])(void);
+	void (*print)(struct matrix *M);
+};
+
+const struct element_type *find_type(const char *name);
+int fixed_index(int n);
+
 /*
  * Globals (not including getopt globals)
  *   These will have to be global when we make this program threaded.
  */
-double **A, **B, **C;
-long TimeCountStart;
-double Freq;
+struct matrix A, B, C;
+const struct element_type *Type;
+struct timespec TimeStart;
 double ElapsedTimeInSeconds;
 
 /*
@@ -47,6 +105,12 @@ int debug = 0;
 int out = 0;
 int unity = 0;
 int unknown = 0;
+int packed = 0;
+int fixed = 0;
+char *kernel = NULL;
+char *type = NULL;
+char *load = NULL;
+char *save = NULL;
 
 /*
  * getopt command-line options
@@ -62,9 +126,27 @@ int unknown = 0;
  * -d, turn on debug/diagnostic messages flag
  * -o, output the matrix values
  * -u, initialize the matrices with 1.0 (unity)
+ * -m <arg>, block kernel: dot, packed or fixed (the default when N is 4,
+ *           8, 16 or 32 and no -i/-j/-k is given, otherwise dot)
+ * -T <arg>, element type: double (default), float, int32 or int16
+ * -L <arg>, map A, B and C from the matrix files <arg>a.mat, <arg>b.mat and
+ *           <arg>c.mat instead of generating them; they give N and the type
+ * -S <arg>, save A, B and C to <arg>a.mat, <arg>b.mat and <arg>c.mat, and
+ *           the final C to <arg>result.mat
  *
  */
-static char *options = "sbN:i:j:k:tdou";
+static char *options = "sbN:i:j:k:tdoum:T:L:S:";
+
+/*
+ * <prefix><name>.mat
+ */
+char *matrix_path(const char *prefix, const char *name)
+{
+	static char path[PATH_MAX];
+
+	snprintf(path, sizeof(path), "%s%s.mat", prefix, name);
+	return path;
+}
 
 /*
  * parse the command-line arguments and check and report any errors
@@ -73,6 +155,7 @@ void parseargs(int argc, char *argv[])
 {
 	int c;
 	int badopt = 0;
+	struct matfile_header h;
 	char *progname = argv[0];
 
 	while ((c = getopt(argc, argv, options)) != -1) {
@@ -118,6 +201,18 @@ void parseargs(int argc, char *argv[])
 		case 'u': /* unity matrices instead of random doubles */
 			unity++;
 			break;
+		case 'm': /* inner kernel used by the block algorithm */
+			kernel = optarg;
+			break;
+		case 'T': /* element type */
+			type = optarg;
+			break;
+		case 'L': /* load the matrices from files */
+			load = optarg;
+			break;
+		case 'S': /* save the matrices to files */
+			save = optarg;
+			break;
 		default:
 			unknown++;
 			badopt++;
@@ -128,6 +223,31 @@ void parseargs(int argc, char *argv[])
 		printf("Must specify either -s (simple) or -b (block) sequential algorithm.\n");
 		badopt++;
 	}
+	/* the loaded matrices give N and the element type */
+	if (load) {
+		if (matfile_read_header(matrix_path(load, "a"), &h) != 0) {
+			badopt++;
+		}
+		else {
+			if (N == 0) {
+				N = h.rows;
+			}
+			if (type == NULL) {
+				type = (char *)matfile_types[h.type].name;
+			}
+		}
+		if (unity) {
+			printf("-u is not used with -L matrices.\n");
+			badopt++;
+		}
+		if ((save)&&(strcmp(load, save) == 0)) {
+			printf("-S would overwrite the matrices -L maps.\n");
+			badopt++;
+		}
+	}
+	if (type == NULL) {
+		type = "double";
+	}
 	/* sanity check on N */
 	if (N == 0) {
 		printf("N is required and must be greater than 0.\n");
@@ -138,8 +258,41 @@ void parseargs(int argc, char *argv[])
 		printf("{i,j,k} block sizes are not used in the simple sequential algorithm.\n");
 		badopt++;
 	}
+	/* element type */
+	if ((Type = find_type(type)) == NULL) {
+		printf("unknown element type %s\n", type);
+		badopt++;
+	}
+	/* kernel selection: the fixed-size kernel whenever there is one for N
+	 * and no block sizes were asked for */
+	if (kernel == NULL) {
+		kernel = ((block)&&(fixed_index(N) >= 0)&&(!istride)&&(!jstride)&&(!kstride)) ? "fixed" : "dot";
+	}
+	if (strcmp(kernel, "packed") == 0) {
+		packed++;
+	}
+	else if (strcmp(kernel, "fixed") == 0) {
+		fixed++;
+		if (fixed_index(N) < 0) {
+			printf("there is no fixed-size kernel for N=%d (4, 8, 16 or 32 only)\n", N);
+			badopt++;
+		}
+		if ((istride)||(jstride)||(kstride)) {
+			printf("{i,j,k} block sizes are not used by the fixed-size kernel.\n");
+			badopt++;
+		}
+	}
+	else if (strcmp(kernel, "dot") != 0) {
+		printf("unknown kernel %s\n", kernel);
+		badopt++;
+	}
+	/* sanity check on the kernel selection */
+	if ((simple)&&((packed)||(fixed))) {
+		printf("-m kernels are not used in the simple sequential algorithm.\n");
+		badopt++;
+	}
 	/* if block sequential algorithm is used set the {i,j,k}stride values */
-	if (block) {
+	if ((block)&&(!fixed)) {
 		if ((!istride)||(!jstride)||(!kstride)) {
 			printf("note: using default block sizes:");
 			if (istride == 0)	{
@@ -164,7 +317,7 @@ void parseargs(int argc, char *argv[])
 	/* print a usage message for any bad command-line */
 	if (badopt || optind < argc) {
 		fprintf(stderr,
-		        "usage: %s -N size -b|-k [-i istride] [-j jstride] [-k kstride] [-t] [-o] [-d] [-u]\n",
+		        "usage: %s -N size -b|-k [-i istride] [-j jstride] [-k kstride] [-t] [-o] [-d] [-u] [-m kernel] [-T type] [-L prefix] [-S prefix]\n",
 		        progname);
 		exit(0);
 	}
@@ -172,118 +325,322 @@ void parseargs(int argc, char *argv[])
 
 /*
  * Initialize timing parameters
- * Based on: https://cygwin.com/ml/cygwin/2000-03/msg00579.html
+ *   CLOCK_MONOTONIC is immune to wall-clock adjustments
  */
 void initialize_time(void)
 {
-	LARGE_INTEGER lFreq, lCnt;
-
-	QueryPerformanceFrequency(&lFreq);
-	Freq = (_64bit) ? (double)lFreq.QuadPart:(double)lFreq.LowPart;
-	QueryPerformanceCounter(&lCnt);
-	TimeCountStart = (_64bit) ? lCnt.QuadPart:lCnt.LowPart;
+	clock_gettime(CLOCK_MONOTONIC, &TimeStart);
 }
 
 void elapsed_time(void)
 {
-	LARGE_INTEGER lCnt;
-	long tcnt;
+	struct timespec now;
 
-	QueryPerformanceCounter(&lCnt);
-	tcnt = (_64bit) ? (lCnt.QuadPart - TimeCountStart):(lCnt.LowPart - TimeCountStart);
-	ElapsedTimeInSeconds = ((double)tcnt)/Freq;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ElapsedTimeInSeconds = (double)(now.tv_sec - TimeStart.tv_sec) + 1e-9 * (now.tv_nsec - TimeStart.tv_nsec);
 }
 
 /*
- * initialize matrices A, B, & C
+ * allocate an N x N matrix of size-byte elements with padded rows
  */
-void initialize(void)
+void matrix_alloc(struct matrix *m, size_t size)
 {
-	int i, j;
-	double *p1;
-	double *p2;
-	double *p3;
-
-	A = (double **) malloc(N*sizeof(double *));
-	B = (double **) malloc(N*sizeof(double *));
-	C = (double **) malloc(N*sizeof(double *));
-
-	p1 = (double *) memalign(getpagesize(),N*N*sizeof(double));
-	p2 = (double *) memalign(getpagesize(),N*N*sizeof(double));
-	p3 = (double *) memalign(getpagesize(),N*N*sizeof(double));
-
-	for (i = 0 ; i < N; i++, p1 += N, p2 += N, p3 += N) {
-		A[i] = p1;
-		B[i] = p2;
-		C[i] = p3;
-	}
+	int per = LINE_SIZE / size;
+	int lines = (N + per - 1) / per;
 
-	for (i = 0; i < N; i++) {
-		for (j = 0; j < N; j++) {
-			A[i][j] = ((debug || unity) ? 1.0 : drand48());
-			B[i][j] = ((debug || unity) ? 1.0 : drand48());
-			C[i][j] = ((debug || unity) ? 1.0 : drand48());
-		}
+	if (lines % 2 == 0)
+		lines++;
+	m->ld = lines * per;
+	m->data = memalign(getpagesize(), (size_t)N*m->ld*size);
+	if (m->data == NULL) {
+		printf("cannot allocate a %d x %d matrix\n", N, N);
+		exit(1);
 	}
 }
 
 /*
- * compute C += A * B using a simple cache oblivious algorithm
+ * map the -L file <name>.mat as the N x N matrix m; its payload is used in
+ * place, with the file's own leading dimension
  */
-void simple_sequential(void)
+void load_matrix(struct matrix *m, const char *name)
 {
-	register int i, j, k;
-	double sum;
-
-	for (i = 0; i < N; i++) {
-		for (j = 0; j < N; j++) {
-			sum = 0.0;
-			for (k = 0; k < N; k++) {
-				sum += A[i][k] * B[k][j];
-			}
-			C[i][j] += sum;
-		}
+	struct matfile_header h;
+	void *map;
+	size_t maplen;
+	char *file = matrix_path(load, name);
+
+	if ((m->data = matfile_map(file, &h, &map, &maplen)) == NULL)
+		exit(1);
+	if (h.type != Type->file_type || h.layout != MATFILE_ROW_MAJOR || h.rows != N || h.cols != N) {
+		printf("%s: expected a %d x %d row-major %s matrix\n", file, N, N, Type->name);
+		exit(1);
 	}
+	m->ld = h.ld;
 }
 
 /*
- * compute C += A * B using a simple cache aware block algorithm
+ * write m to the -S file <name>.mat, padding and all
  */
-void block_sequential(void)
+void save_matrix(struct matrix *m, const char *name)
 {
-	register int i, j, k, kk, ii, jj;
-	double sum;
-	int I, J, K;
-
-	if (debug) printf("istride=%d, jstride=%d, kstride=%d\n",istride,jstride,kstride);
-	for (ii = 0; ii < N; ii += istride) {
-		for (jj = 0; jj < N; jj += jstride) {
-			for (kk = 0; kk < N; kk += kstride) {
-				I = MIN(ii+istride,N);
-				for (i = ii; i < I; i++) {
-					J = MIN(jj+jstride,N);
-					for (j = jj; j < J; j++) {
-						K = MIN(kk+kstride,N);
-						sum = 0.0;
-						for (k = kk; k < K; k++) {
-							sum += A[i][k] * B[k][j];
-						}
-						C[i][j] += sum;
-					}
-				}
-			}
-		}
-	}
+	struct matfile_header h;
+
+	matfile_header_init(&h, Type->file_type, MATFILE_ROW_MAJOR, N, N, m->ld);
+	if (matfile_write(matrix_path(save, name), &h, m->data, 0) != 0)
+		exit(1);
+}
+
+/*
+ * Panel packing (GotoBLAS style)
+ *   pack_a() copies A[ii:I][kk:K] into slivers of MR rows stored column by
+ *   column, pack_b() copies B[kk:K][jj:J] into slivers of NR columns stored
+ *   row by row, both zero padded to whole slivers. The micro-kernel then
+ *   reads two contiguous, aligned streams instead of striding down the
+ *   columns of B one row at a time.
+ */
+#define MR 4
+#define NR 4
+#define PACK_ALIGN 64
+
+/*
+ * Kernel templates
+ *   ELEMENT_KERNELS() expands to every kernel for one element type T, with
+ *   sums formed in the accumulator type ACC, and FIXED_KERNEL() to the
+ *   kernel for one fixed size S. The element type, and for the fixed
+ *   kernels the size, are constants in the expanded code, so each copy is
+ *   compiled as if written by hand for that case.
+ */
+#define ELEMENT_KERNELS(name, T, ACC, FMT, RAND, FTYPE) \
+/* allocate A, B, & C and fill them element by element */ \
+static void initialize_##name(void) \
+{ \
+	T *restrict a, *restrict b, *restrict c; \
+	size_t ld; \
+	int i, j; \
+\
+	matrix_alloc(&A, sizeof(T)); \
+	matrix_alloc(&B, sizeof(T)); \
+	matrix_alloc(&C, sizeof(T)); \
+	a = A.data; \
+	b = B.data; \
+	c = C.data; \
+	ld = A.ld; \
+	for (i = 0; i < N; i++) { \
+		for (j = 0; j < N; j++) { \
+			a[i*ld + j] = (T)((debug || unity) ? 1.0 : (RAND)); \
+			b[i*ld + j] = (T)((debug || unity) ? 1.0 : (RAND)); \
+			c[i*ld + j] = (T)((debug || unity) ? 1.0 : (RAND)); \
+		} \
+	} \
+} \
+\
+/* C += A * B using a simple cache oblivious algorithm */ \
+static void simple_##name(void) \
+{ \
+	register int i, j, k; \
+	ACC sum; \
+	const T *restrict a = A.data, *restrict b = B.data; \
+	T *restrict c = C.data; \
+	size_t lda = A.ld, ldb = B.ld, ldc = C.ld; \
+\
+	for (i = 0; i < N; i++) { \
+		for (j = 0; j < N; j++) { \
+			sum = 0; \
+			for (k = 0; k < N; k++) { \
+				sum += a[i*lda + k] * b[k*ldb + j]; \
+			} \
+			c[i*ldc + j] += sum; \
+		} \
+	} \
+} \
+\
+/* C += A * B using a simple cache aware block algorithm */ \
+static void block_##name(void) \
+{ \
+	register int i, j, k, kk, ii, jj; \
+	ACC sum; \
+	int I, J, K; \
+	const T *restrict a = A.data, *restrict b = B.data; \
+	T *restrict c = C.data; \
+	size_t lda = A.ld, ldb = B.ld, ldc = C.ld; \
+\
+	if (debug) printf("istride=%d, jstride=%d, kstride=%d\n",istride,jstride,kstride); \
+	for (ii = 0; ii < N; ii += istride) { \
+		for (jj = 0; jj < N; jj += jstride) { \
+			for (kk = 0; kk < N; kk += kstride) { \
+				I = MIN(ii+istride,N); \
+				for (i = ii; i < I; i++) { \
+					J = MIN(jj+jstride,N); \
+					for (j = jj; j < J; j++) { \
+						K = MIN(kk+kstride,N); \
+						sum = 0; \
+						for (k = kk; k < K; k++) { \
+							sum += a[i*lda + k] * b[k*ldb + j]; \
+						} \
+						c[i*ldc + j] += sum; \
+					} \
+				} \
+			} \
+		} \
+	} \
+} \
+\
+static void pack_a_##name(T *restrict ap, int ii, int I, int kk, int K) \
+{ \
+	register int i, k, r; \
+	const T *restrict a = A.data; \
+	size_t lda = A.ld; \
+\
+	for (i = ii; i < I; i += MR) { \
+		for (k = kk; k < K; k++) { \
+			for (r = 0; r < MR; r++) \
+				*ap++ = (i+r < I) ? a[(i+r)*lda + k] : 0; \
+		} \
+	} \
+} \
+\
+static void pack_b_##name(T *restrict bp, int jj, int J, int kk, int K) \
+{ \
+	register int j, k, q; \
+	const T *restrict b = B.data; \
+	size_t ldb = B.ld; \
+\
+	for (j = jj; j < J; j += NR) { \
+		for (k = kk; k < K; k++) { \
+			for (q = 0; q < NR; q++) \
+				*bp++ = (j+q < J) ? b[k*ldb + j+q] : 0; \
+		} \
+	} \
+} \
+\
+/* t[MR][NR] = a * b over kc packed columns/rows */ \
+static void packed_tile_##name(int kc, const T *restrict a, const T *restrict b, ACC t[restrict MR][NR]) \
+{ \
+	register int k, r, q; \
+\
+	memset(t, 0, MR*NR*sizeof(ACC)); \
+	for (k = 0; k < kc; k++, a += MR, b += NR) { \
+		for (r = 0; r < MR; r++) \
+			for (q = 0; q < NR; q++) \
+				t[r][q] += a[r] * b[q]; \
+	} \
+} \
+\
+/* C += A * B using the cache aware block algorithm with packed A and B \
+   panels. The packing buffers are allocated once and reused for every \
+   block. */ \
+static void packed_##name(void) \
+{ \
+	register int i, j, r, q; \
+	int ii, jj, kk, I, J, K, kc; \
+	ACC t[MR][NR]; \
+	T *apack, *bpack; \
+	const T *ap, *bp; \
+	T *restrict c = C.data; \
+	size_t ldc = C.ld; \
+\
+	if (debug) printf("istride=%d, jstride=%d, kstride=%d (packed)\n",istride,jstride,kstride); \
+	apack = (T *) memalign(PACK_ALIGN, (size_t)(istride+MR-1)/MR*MR*kstride*sizeof(T)); \
+	bpack = (T *) memalign(PACK_ALIGN, (size_t)(jstride+NR-1)/NR*NR*kstride*sizeof(T)); \
+	for (jj = 0; jj < N; jj += jstride) { \
+		J = MIN(jj+jstride,N); \
+		for (kk = 0; kk < N; kk += kstride) { \
+			K = MIN(kk+kstride,N); \
+			kc = K - kk; \
+			pack_b_##name(bpack, jj, J, kk, K); \
+			for (ii = 0; ii < N; ii += istride) { \
+				I = MIN(ii+istride,N); \
+				pack_a_##name(apack, ii, I, kk, K); \
+				for (i = ii, ap = apack; i < I; i += MR, ap += MR*kc) { \
+					for (j = jj, bp = bpack; j < J; j += NR, bp += NR*kc) { \
+						packed_tile_##name(kc, ap, bp, t); \
+						for (r = 0; r < MR && i+r < I; r++) \
+							for (q = 0; q < NR && j+q < J; q++) \
+								c[(i+r)*ldc + j+q] += t[r][q]; \
+					} \
+				} \
+			} \
+		} \
+	} \
+	free(apack); \
+	free(bpack); \
+} \
+\
+FIXED_KERNEL(name, T, ACC, 4) \
+FIXED_KERNEL(name, T, ACC, 8) \
+FIXED_KERNEL(name, T, ACC, 16) \
+FIXED_KERNEL(name, T, ACC, 32) \
+\
+static void print_##name(struct matrix *M) \
+{ \
+	const T *m = M->data; \
+	int i, j; \
+\
+	for (i = 0; i < N; i++) { \
+		for (j = 0; j < N; j++) printf(FMT, m[(size_t)i*M->ld + j]); \
+		putchar('\n'); \
+	} \
 }
 
-void printarray(double **A)
+/*
+ * C += A * B for N == S. A row of C's sums is held in sum[], and with S
+ * a constant the j loops unroll completely, leaving sum[] in registers
+ * while the k loop streams a row of A against the rows of B. The sums
+ * are formed in the same order as the dot kernel's.
+ */
+#define FIXED_KERNEL(name, T, ACC, S) \
+static void fixed_##name##_##S(void) \
+{ \
+	const T *restrict a = A.data, *restrict b = B.data; \
+	T *restrict c = C.data; \
+	size_t lda = A.ld, ldb = B.ld, ldc = C.ld; \
+	ACC sum[S], aik; \
+	int i, j, k; \
+\
+	for (i = 0; i < S; i++) { \
+		_Pragma("GCC unroll 32") \
+		for (j = 0; j < S; j++) \
+			sum[j] = 0; \
+		for (k = 0; k < S; k++) { \
+			aik = a[i*lda + k]; \
+			_Pragma("GCC unroll 32") \
+			for (j = 0; j < S; j++) \
+				sum[j] += aik * b[k*ldb + j]; \
+		} \
+		_Pragma("GCC unroll 32") \
+		for (j = 0; j < S; j++) \
+			c[i*ldc + j] += sum[j]; \
+	} \
+}
+
+ELEMENT_TYPES(ELEMENT_KERNELS)
+
+#define ELEMENT_ENTRY(name, T, ACC, FMT, RAND, FTYPE) \
+	{ #name, FTYPE, initialize_##name, simple_##name, block_##name, packed_##name, \
+	  { fixed_##name##_4, fixed_##name##_8, fixed_##name##_16, fixed_##name##_32 }, print_##name },
+static const struct element_type ElementTypes[] = { ELEMENT_TYPES(ELEMENT_ENTRY) };
+
+const struct element_type *find_type(const char *name)
 {
-	int i, j;
+	int i;
 
-	for (i = 0; i < N; i++) {
-		for (j = 0; j < N; j++) printf(" %0.1e", A[i][j]);
-		putchar('\n');
-	}
+	for (i = 0; i < sizeof(ElementTypes) / sizeof(ElementTypes[0]); i++)
+		if (strcmp(ElementTypes[i].name, name) == 0)
+			return &ElementTypes[i];
+	return NULL;
+}
+
+/*
+ * index of the fixed-size kernel for n, or -1 if there is none
+ */
+int fixed_index(int n)
+{
+	int i;
+
+	for (i = 0; i < NFIXED; i++)
+		if (FixedSizes[i] == n)
+			return i;
+	return -1;
 }
 
 int main(int argc, char *argv[])
@@ -292,30 +649,50 @@ int main(int argc, char *argv[])
 	if (debug) {
 		printf("System page size is %d\n",getpagesize());
 	}
-	initialize();
+	if (load) {
+		load_matrix(&A, "a");
+		load_matrix(&B, "b");
+		load_matrix(&C, "c");
+	}
+	else {
+		Type->initialize();
+	}
+	if (save) {
+		save_matrix(&A, "a");
+		save_matrix(&B, "b");
+		save_matrix(&C, "c");
+	}
 	if (out) {
 		printf("A =\n");
-		printarray(A);
+		Type->print(&A);
 		printf("B =\n");
-		printarray(B);
+		Type->print(&B);
 		printf("C =\n");
-		printarray(C);
+		Type->print(&C);
 	}
 	if (simple) {
 		initialize_time();
-		simple_sequential();
+		Type->simple();
 		elapsed_time();
 		if (timing) printf("%f\n",ElapsedTimeInSeconds);
 	}
 	else if (block) {
 		initialize_time();
-		block_sequential();
+		if (fixed)
+			Type->fixed[fixed_index(N)]();
+		else if (packed)
+			Type->packed();
+		else
+			Type->block();
 		elapsed_time();
 		if (timing) printf("%f\n",ElapsedTimeInSeconds);
 	}
 	if (out) {
 		printf("C =\n");
-		printarray(C);
+		Type->print(&C);
+	}
+	if (save) {
+		save_matrix(&C, "result");
 	}
 	return(0);
 }
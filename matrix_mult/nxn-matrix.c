@@ -1,106 +1,573 @@
-#include <stdio.h>
-#include <stdlib.h>
-#include <math.h>
-#include <unistd.h>
-#include <time.h>
-
-int main(int argc, char** argv)
-{
-    //initial variable declarations
-    int n, t, ch, row, col, m, f, max;
-    n = 0;
-    max = 0;
-    f = 0;
-
-    //create file handles and open files to store data points
-    FILE* fid0, *fid1, *fid2, *fid3;
-
-    //seed the random generator and set the option error variable
-    srand(time(NULL));
-    opterr = 1;
-
-    //check for command line inputs.
-    while((ch = getopt(argc, argv, "fm:n:t:")) != -1)
-    {
-        switch(ch)
-        {
-	    case 'f':
-	       f = 1;
-	       break;
-            case 'm':
-                max = atoi(optarg);
-                break;
-            case 'n':
-                n = atoi(optarg);
-                break;
-            case 't':
-                fprintf(stderr, "Threading has not yet been implemented.\n", optopt);
-                return 1;
-            default:
-                abort();
-        }
-    }
-
-    if(!n) n = 4; //if n was not given use 4
-    if(!max) max = 10; //if max not specified use 10.
-    if(f)
-    {
-        fid0 = (FILE*)fopen("c.txt", "w");
-        fid1 = (FILE*)fopen("b.txt", "w");
-        fid2 = (FILE*)fopen("a.txt", "w");
-        fid3 = (FILE*)fopen("result.txt", "w");
-    }
-    //create matrices
-    int a[n][n];
-    int b[n][n];
-    int c[n][n];
-
-    //fill matrices.
-    for(row = 0; row < n; row++)
-    {
-        for(col = 0; col < n; col++)
-        {
-            a[row][col] = rand()%max;
-            b[row][col] = rand()%max;
-            c[row][col] = rand()%max;
-           if(f)  fprintf(fid0, "%d\t", c[row][col]);
-        }
-       if(f) fprintf(fid0, "\n");
-    }
-
-    //compute c = c + a*b
-    for(row = 0; row < n; row++)
-    {
-        for(col = 0; col < n; col++)
-        {
-            for(m = 0; m < n; m++)
-            {
-                c[row][col] += a[row][m]*b[m][col];
-            }
-        }
-    }
-
-    if(f)
-   {
-        //write results to a file.
-        for(row = 0; row < n; row++)
-        {
-            for(col = 0; col < n; col++)
-            {
-                fprintf(fid3, "%d\t", c[row][col]);
-                fprintf(fid1, "%d\t", b[row][col]);
-                fprintf(fid2, "%d\t", a[row][col]);
-            }
-            fprintf(fid3, "\n");
-            fprintf(fid1, "\n");
-            fprintf(fid2, "\n");
-        }
-
-        //close files.
-        fclose(fid0);
-        fclose(fid1);
-        fclose(fid2);
-        fclose(fid3);
-    }
-    return 0;
-}
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include "matfile.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_AVX2_KERNEL 1
+#endif
+
+#define MIN(a,b) (((a)<(b))?(a):(b))
+
+//cache blocking of the multiply: a KC deep slice of NC columns of b is
+//reused by every row of c before moving on. KC is even, k runs in pairs.
+#define KC 256
+#define NC 256
+#define ALIGN 64
+
+//one heap block holds every matrix and packed copy, carved out in order
+struct arena
+{
+    char *base;
+    size_t size;
+    size_t used;
+};
+
+//c += a*b for n x n matrices. a and b hold "width"-bit integers (8, 16 or
+//32), c holds int32 with rows of ldc. For narrow inputs a is widened to
+//int16 rows of kp (n rounded up to even) in ap, and b to int16 pairs in
+//bp: row k/2 of bp is b[k][0], b[k+1][0], b[k][1], b[k+1][1], ... so
+//that one pmaddwd multiplies a pair of a's row by a pair of b's rows.
+struct problem
+{
+    int n, kp, ldc, width;
+    void *a, *b;
+    int32_t *c;
+    int16_t *ap, *bp;
+    int nthreads;
+    int avx2;
+};
+
+struct thread_arg
+{
+    struct problem *p;
+    int id;
+};
+
+//a matrix file mapping kept because its payload is used in place
+struct mapping
+{
+    void *map;
+    size_t len;
+};
+
+void *arena_take(struct arena *ar, size_t bytes)
+{
+    void *p = ar->base + ar->used;
+
+    ar->used += (bytes + ALIGN - 1) / ALIGN * ALIGN;
+    return p;
+}
+
+int element(const void *m, int width, size_t i)
+{
+    switch(width)
+    {
+        case 8:
+            return ((const int8_t*)m)[i];
+        case 16:
+            return ((const int16_t*)m)[i];
+        default:
+            return ((const int32_t*)m)[i];
+    }
+}
+
+void set_element(void *m, int width, size_t i, int v)
+{
+    switch(width)
+    {
+        case 8:
+            ((int8_t*)m)[i] = v;
+            break;
+        case 16:
+            ((int16_t*)m)[i] = v;
+            break;
+        default:
+            ((int32_t*)m)[i] = v;
+    }
+}
+
+//largest |element| of the n x n matrix m, rows ld elements apart
+long long max_abs(const void *m, int width, int n, int ld)
+{
+    long long v, most = 0;
+    int row, col;
+
+    for(row = 0; row < n; row++)
+        for(col = 0; col < n; col++)
+        {
+            v = llabs((long long)element(m, width, (size_t)row * ld + col));
+            if(v > most)
+                most = v;
+        }
+    return most;
+}
+
+//matrix file element type of a width
+enum matfile_type width_type(int width)
+{
+    return (width == 8) ? MATFILE_INT8 : (width == 16) ? MATFILE_INT16 : MATFILE_INT32;
+}
+
+//map "file", which must hold an n x n row-major matrix of "type". Its
+//payload is used in place when its rows are ld elements apart, and the
+//mapping is left in *mp for unmap_matrices(); else it is copied into rows
+//of ld at dst and unmapped. Returns the matrix, or NULL on error.
+void *load_matrix(const char *file, int n, enum matfile_type type, int ld, void *dst, struct mapping *mp)
+{
+    struct matfile_header h;
+    size_t row, maplen, esize = matfile_types[type].size;
+    void *map;
+    char *data;
+
+    if((data = matfile_map(file, &h, &map, &maplen)) == NULL)
+        return NULL;
+    if(h.type != type || h.layout != MATFILE_ROW_MAJOR || h.rows != n || h.cols != n)
+    {
+        fprintf(stderr, "%s: expected a %d x %d row-major %s matrix.\n", file, n, n, matfile_types[type].name);
+        munmap(map, maplen);
+        return NULL;
+    }
+    if(h.ld == ld)
+    {
+        mp->map = map;
+        mp->len = maplen;
+        return data;
+    }
+    for(row = 0; row < n; row++)
+        memcpy((char*)dst + row * ld * esize, data + row * h.ld * esize, n * esize);
+    munmap(map, maplen);
+    return dst;
+}
+
+//unmap the matrices load_matrix() left in place
+void unmap_matrices(struct mapping *maps, int count)
+{
+    int i;
+
+    for(i = 0; i < count; i++)
+        if(maps[i].map)
+            munmap(maps[i].map, maps[i].len);
+}
+
+//write the n x n matrix m, rows ld elements apart, to "file"
+int save_matrix(const char *file, int n, enum matfile_type type, int ld, const void *m, int nthreads)
+{
+    struct matfile_header h;
+
+    matfile_header_init(&h, type, MATFILE_ROW_MAJOR, n, n, ld);
+    return matfile_write(file, &h, m, nthreads);
+}
+
+//rows [*i0, *i1) of the n rows belong to thread id
+void band(const struct problem *p, int n, int id, int *i0, int *i1)
+{
+    *i0 = (long long)n * id / p->nthreads;
+    *i1 = (long long)n * (id + 1) / p->nthreads;
+}
+
+//widen this thread's rows of a, and rows of b pairs, to int16
+void pack(struct problem *p, int id)
+{
+    int i, k, j, i0, i1, n = p->n, kp = p->kp, ldb = 2 * p->ldc;
+    int16_t *row;
+
+    band(p, n, id, &i0, &i1);
+    for(i = i0; i < i1; i++)
+    {
+        row = p->ap + (size_t)i * kp;
+        for(k = 0; k < n; k++)
+            row[k] = element(p->a, p->width, (size_t)i * n + k);
+        for(; k < kp; k++)
+            row[k] = 0;
+    }
+    band(p, kp / 2, id, &i0, &i1);
+    for(k = 2 * i0; k < 2 * i1; k++)
+    {
+        row = p->bp + (size_t)(k / 2) * ldb + (k & 1);
+        for(j = 0; j < p->ldc; j++)
+            row[2 * j] = (k < n && j < n) ? element(p->b, p->width, (size_t)k * n + j) : 0;
+    }
+}
+
+//blocked ikj over int32 inputs: c[i][j] += a[i][k] * b[k][j] with the
+//j loop innermost, so b and c are both walked along their rows. SSE2 has
+//no 32-bit vector multiply, so there is also an AVX2 (vpmulld) build of
+//it, picked at load time.
+#ifdef HAVE_AVX2_KERNEL
+__attribute__((target_clones("avx2", "default")))
+#endif
+void mult_int32(struct problem *p, int i0, int i1)
+{
+    int i, j, k, jj, kk, J, K, n = p->n;
+    const int32_t *a = p->a, *b = p->b, *restrict brow;
+    int32_t *restrict crow, aik;
+
+    for(jj = 0; jj < n; jj += NC)
+    {
+        J = MIN(jj + NC, n);
+        for(kk = 0; kk < n; kk += KC)
+        {
+            K = MIN(kk + KC, n);
+            for(i = i0; i < i1; i++)
+            {
+                crow = p->c + (size_t)i * p->ldc;
+                for(k = kk; k < K; k++)
+                {
+                    aik = a[(size_t)i * n + k];
+                    brow = b + (size_t)k * n;
+                    for(j = jj; j < J; j++)
+                        crow[j] += aik * brow[j];
+                }
+            }
+        }
+    }
+}
+
+//blocked ikj over the packed int16 pairs, two k at a time
+void mult_pairs(struct problem *p, int i0, int i1)
+{
+    int i, j, k, jj, kk, J, K, ldb = 2 * p->ldc;
+    const int16_t *arow, *restrict brow;
+    int32_t *restrict crow, a0, a1;
+
+    for(jj = 0; jj < p->ldc; jj += NC)
+    {
+        J = MIN(jj + NC, p->ldc);
+        for(kk = 0; kk < p->kp; kk += KC)
+        {
+            K = MIN(kk + KC, p->kp);
+            for(i = i0; i < i1; i++)
+            {
+                crow = p->c + (size_t)i * p->ldc;
+                arow = p->ap + (size_t)i * p->kp;
+                for(k = kk; k < K; k += 2)
+                {
+                    a0 = arow[k];
+                    a1 = arow[k + 1];
+                    brow = p->bp + (size_t)(k / 2) * ldb;
+                    for(j = jj; j < J; j++)
+                        crow[j] += a0 * brow[2 * j] + a1 * brow[2 * j + 1];
+                }
+            }
+        }
+    }
+}
+
+#ifdef HAVE_AVX2_KERNEL
+//mult_pairs() with vpmaddwd: the pair (a[i][k], a[i][k+1]) is broadcast
+//to every 32-bit lane, and one instruction forms
+//a[i][k]*b[k][j] + a[i][k+1]*b[k+1][j] for 8 columns j at once. Rows of c
+//are padded to a multiple of 8 columns, so there is no ragged edge.
+__attribute__((target("avx2")))
+void mult_pairs_avx2(struct problem *p, int i0, int i1)
+{
+    int i, j, k, jj, kk, J, K, ldb = 2 * p->ldc;
+    const int16_t *arow, *brow;
+    int32_t *crow, pair;
+    __m256i ak, cj;
+
+    for(jj = 0; jj < p->ldc; jj += NC)
+    {
+        J = MIN(jj + NC, p->ldc);
+        for(kk = 0; kk < p->kp; kk += KC)
+        {
+            K = MIN(kk + KC, p->kp);
+            for(i = i0; i < i1; i++)
+            {
+                crow = p->c + (size_t)i * p->ldc;
+                arow = p->ap + (size_t)i * p->kp;
+                for(k = kk; k < K; k += 2)
+                {
+                    memcpy(&pair, &arow[k], sizeof(pair));
+                    ak = _mm256_set1_epi32(pair);
+                    brow = p->bp + (size_t)(k / 2) * ldb;
+                    for(j = jj; j < J; j += 8)
+                    {
+                        cj = _mm256_load_si256((const __m256i*)&crow[j]);
+                        cj = _mm256_add_epi32(cj, _mm256_madd_epi16(ak, _mm256_load_si256((const __m256i*)&brow[2 * j])));
+                        _mm256_store_si256((__m256i*)&crow[j], cj);
+                    }
+                }
+            }
+        }
+    }
+}
+#endif
+
+void *pack_thread(void *arg)
+{
+    struct thread_arg *t = arg;
+
+    pack(t->p, t->id);
+    return NULL;
+}
+
+void *mult_thread(void *arg)
+{
+    struct thread_arg *t = arg;
+    struct problem *p = t->p;
+    int i0, i1;
+
+    band(p, p->n, t->id, &i0, &i1);
+    if(p->width == 32)
+        mult_int32(p, i0, i1);
+#ifdef HAVE_AVX2_KERNEL
+    else if(p->avx2)
+        mult_pairs_avx2(p, i0, i1);
+#endif
+    else
+        mult_pairs(p, i0, i1);
+    return NULL;
+}
+
+//run fn on p->nthreads threads, one band each, and wait for them all
+int run_threads(struct problem *p, void *(*fn)(void *))
+{
+    pthread_t tid[p->nthreads];
+    struct thread_arg args[p->nthreads];
+    int t;
+
+    for(t = 0; t < p->nthreads; t++)
+    {
+        args[t].p = p;
+        args[t].id = t;
+        if(pthread_create(&tid[t], NULL, fn, &args[t]) != 0)
+        {
+            fprintf(stderr, "Cannot create thread %d.\n", t);
+            return 1;
+        }
+    }
+    for(t = 0; t < p->nthreads; t++)
+        pthread_join(tid[t], NULL);
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    //initial variable declarations
+    int n, t, ch, row, col, f, max, width, bin, load;
+    struct problem p;
+    struct arena ar;
+    struct matfile_header h;
+    struct mapping maps[3];
+    size_t esize;
+    memset(maps, 0, sizeof(maps));
+    n = 0;
+    max = 0;
+    f = 0;
+    bin = 0;
+    load = 0;
+    t = 1;
+    width = 32;
+
+    //create file handles and open files to store data points
+    FILE* fid0 = NULL, *fid1 = NULL, *fid2 = NULL, *fid3 = NULL;
+
+    //seed the random generator and set the option error variable
+    srand(time(NULL));
+    opterr = 1;
+
+    //check for command line inputs.
+    while((ch = getopt(argc, argv, "fFlm:n:t:w:")) != -1)
+    {
+        switch(ch)
+        {
+            case 'f':
+                f = 1;
+                break;
+            case 'F':
+                bin = 1;
+                break;
+            case 'l':
+                load = 1;
+                break;
+            case 'm':
+                max = atoi(optarg);
+                break;
+            case 'n':
+                n = atoi(optarg);
+                break;
+            case 't':
+                t = atoi(optarg);
+                break;
+            case 'w':
+                width = atoi(optarg);
+                break;
+            default:
+                abort();
+        }
+    }
+
+    //with -l the size and width come from a.mat
+    if(load)
+    {
+        if(bin)
+        {
+            fprintf(stderr, "-F would overwrite the matrices -l loads.\n");
+            return 1;
+        }
+        if(matfile_read_header("a.mat", &h) != 0)
+            return 1;
+        if(h.type != MATFILE_INT8 && h.type != MATFILE_INT16 && h.type != MATFILE_INT32)
+        {
+            fprintf(stderr, "a.mat: holds %s elements, not integers.\n", matfile_types[h.type].name);
+            return 1;
+        }
+        if(n && n != h.rows)
+        {
+            fprintf(stderr, "a.mat: holds a %llu x %llu matrix, not %d x %d.\n",
+                    (unsigned long long)h.rows, (unsigned long long)h.cols, n, n);
+            return 1;
+        }
+        n = h.rows;
+        width = 8 * h.elem_size;
+    }
+    if(!n) n = 4; //if n was not given use 4
+    if(!max) max = 10; //if max not specified use 10.
+    if(t < 1)
+    {
+        fprintf(stderr, "Need at least one thread.\n");
+        return 1;
+    }
+    if(width != 8 && width != 16 && width != 32)
+    {
+        fprintf(stderr, "Element width must be 8, 16 or 32 bits.\n");
+        return 1;
+    }
+    //entries are 0..max-1: they must fit the width, and a full dot
+    //product plus the starting value of c must fit in int32. Loaded
+    //matrices are checked the same way once they are mapped.
+    if(!load && (max < 1 || max > (1LL << (width - 1)) ||
+       (double)n * (max - 1) * (max - 1) + (max - 1) > INT32_MAX))
+    {
+        fprintf(stderr, "Entries below %d overflow %d-bit inputs or int32 sums at n = %d.\n", max, width, n);
+        return 1;
+    }
+    if(f)
+    {
+        fid0 = (FILE*)fopen("c.txt", "w");
+        fid1 = (FILE*)fopen("b.txt", "w");
+        fid2 = (FILE*)fopen("a.txt", "w");
+        fid3 = (FILE*)fopen("result.txt", "w");
+    }
+
+    //create matrices on the heap; rows of c (and of the packed b) are
+    //padded to whole 8-column vectors
+    memset(&p, 0, sizeof(p));
+    p.n = n;
+    p.kp = (n + 1) & ~1;
+    p.ldc = (n + 7) & ~7;
+    p.width = width;
+    p.nthreads = MIN(t, n);
+#ifdef HAVE_AVX2_KERNEL
+    p.avx2 = __builtin_cpu_supports("avx2");
+#endif
+    esize = width / 8;
+    ar.size = 2 * ((size_t)n * n * esize + ALIGN) + (size_t)n * p.ldc * sizeof(int32_t) + ALIGN;
+    if(width < 32)
+        ar.size += ((size_t)n * p.kp + (size_t)p.kp * p.ldc) * sizeof(int16_t) + 2 * ALIGN;
+    ar.used = 0;
+    if((ar.base = aligned_alloc(ALIGN, (ar.size + ALIGN - 1) / ALIGN * ALIGN)) == NULL)
+    {
+        fprintf(stderr, "Cannot allocate %zu bytes for n = %d.\n", ar.size, n);
+        return 1;
+    }
+    p.a = arena_take(&ar, (size_t)n * n * esize);
+    p.b = arena_take(&ar, (size_t)n * n * esize);
+    p.c = arena_take(&ar, (size_t)n * p.ldc * sizeof(int32_t));
+    if(width < 32)
+    {
+        p.ap = arena_take(&ar, (size_t)n * p.kp * sizeof(int16_t));
+        p.bp = arena_take(&ar, (size_t)p.kp * p.ldc * sizeof(int16_t));
+    }
+    memset(p.c, 0, (size_t)n * p.ldc * sizeof(int32_t));
+
+    if(load)
+    {
+        //map a.mat, b.mat and c.mat, in place where the layout matches
+        if((p.a = load_matrix("a.mat", n, width_type(width), n, p.a, &maps[0])) == NULL ||
+           (p.b = load_matrix("b.mat", n, width_type(width), n, p.b, &maps[1])) == NULL ||
+           (p.c = load_matrix("c.mat", n, MATFILE_INT32, p.ldc, p.c, &maps[2])) == NULL)
+        {
+            unmap_matrices(maps, 3);
+            return 1;
+        }
+        if((double)n * max_abs(p.a, width, n, n) * max_abs(p.b, width, n, n) +
+           max_abs(p.c, 32, n, p.ldc) > INT32_MAX)
+        {
+            fprintf(stderr, "Loaded entries overflow int32 sums at n = %d.\n", n);
+            unmap_matrices(maps, 3);
+            return 1;
+        }
+    }
+    else
+    {
+        //fill matrices.
+        for(row = 0; row < n; row++)
+        {
+            for(col = 0; col < n; col++)
+            {
+                set_element(p.a, width, (size_t)row * n + col, rand()%max);
+                set_element(p.b, width, (size_t)row * n + col, rand()%max);
+                p.c[(size_t)row * p.ldc + col] = rand()%max;
+            }
+        }
+    }
+    if(f)
+    {
+        for(row = 0; row < n; row++)
+        {
+            for(col = 0; col < n; col++)
+                fprintf(fid0, "%d\t", p.c[(size_t)row * p.ldc + col]);
+            fprintf(fid0, "\n");
+        }
+    }
+    if(bin)
+    {
+        //binary copies of the inputs, written by the -t threads
+        if(save_matrix("a.mat", n, width_type(width), n, p.a, p.nthreads) != 0 ||
+           save_matrix("b.mat", n, width_type(width), n, p.b, p.nthreads) != 0 ||
+           save_matrix("c.mat", n, MATFILE_INT32, p.ldc, p.c, p.nthreads) != 0)
+            return 1;
+    }
+
+    //compute c = c + a*b
+    if(width < 32 && run_threads(&p, pack_thread) != 0)
+        return 1;
+    if(run_threads(&p, mult_thread) != 0)
+        return 1;
+
+    if(f)
+   {
+        //write results to a file.
+        for(row = 0; row < n; row++)
+        {
+            for(col = 0; col < n; col++)
+            {
+                fprintf(fid3, "%d\t", p.c[(size_t)row * p.ldc + col]);
+                fprintf(fid1, "%d\t", element(p.b, width, (size_t)row * n + col));
+                fprintf(fid2, "%d\t", element(p.a, width, (size_t)row * n + col));
+            }
+            fprintf(fid3, "\n");
+            fprintf(fid1, "\n");
+            fprintf(fid2, "\n");
+        }
+
+        //close files.
+        fclose(fid0);
+        fclose(fid1);
+        fclose(fid2);
+        fclose(fid3);
+    }
+    if(bin && save_matrix("result.mat", n, MATFILE_INT32, p.ldc, p.c, p.nthreads) != 0)
+        return 1;
+    unmap_matrices(maps, 3);
+    free(ar.base);
+    return 0;
+}
@@ -0,0 +1,832 @@
+/*
+ * gemm.c -- threaded, blocked double-precision matrix multiply
+ *
+ * The engine behind mmult: packed panels swept by a register-blocked
+ * micro-kernel, C cut into tiles handed out by a shared counter or by
+ * work stealing, and a persistent pool of workers. See gemm.h for the
+ * interface.
+ *
+ * Everything a multiply touches hangs off its struct gemm_context; the
+ * only file-scope data is the constant kernel table.
+ */
+
+#define _GNU_SOURCE	/* pthread_setaffinity_np() */
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <malloc.h> /* memalign() */
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+#include "gemm.h"
+
+#define MIN(a,b) (((a)<(b))?(a):(b))
+#define MAX(a,b) (((a)>(b))?(a):(b))
+
+#define DEFAULT_BLOCK (256/sizeof(double))
+#define CACHE_LINE 64
+#define PACK_ALIGN 64
+
+/*
+ * Register-blocked micro-kernels
+ *   Each one computes an MR x NR tile of C, c[0:MR][0:NR] += a * b (row
+ *   stride ldc), keeping the whole tile in registers across the k loop. a
+ *   and b are slivers of the packed panels (see pack_a() and pack_b()): for
+ *   every k, a holds MR consecutive values of a column of op(A) and b holds
+ *   NR consecutive values of a row of op(B), so both are read with unit
+ *   stride.
+ */
+#define MR 4
+#define NRMAX 8
+
+struct kernel
+{
+	const char *name;
+	int mr;
+	int nr;
+	void (*tile)(int kc, const double *restrict a, const double *restrict b, double *restrict c, int ldc);
+};
+
+static void scalar_4x4(int kc, const double *restrict a, const double *restrict b, double *restrict c, int ldc)
+{
+	register int k, r, q;
+	double t[MR][4];
+
+	memset(t, 0, sizeof(t));
+	for (k = 0; k < kc; k++, a += MR, b += 4) {
+		for (r = 0; r < MR; r++)
+			for (q = 0; q < 4; q++)
+				t[r][q] += a[r] * b[q];
+	}
+	for (r = 0; r < MR; r++)
+		for (q = 0; q < 4; q++)
+			c[(size_t)r*ldc + q] += t[r][q];
+}
+
+#ifdef HAVE_X86_SIMD
+__attribute__((target("sse2")))
+static void sse2_4x4(int kc, const double *restrict a, const double *restrict b, double *restrict c, int ldc)
+{
+	register int k;
+	__m128d c00, c01, c10, c11, c20, c21, c30, c31;
+	__m128d b0, b1, ak;
+	double *c0 = c, *c1 = c + ldc, *c2 = c + 2*(size_t)ldc, *c3 = c + 3*(size_t)ldc;
+
+	c00 = c01 = c10 = c11 = c20 = c21 = c30 = c31 = _mm_setzero_pd();
+	for (k = 0; k < kc; k++, a += MR, b += 4) {
+		b0 = _mm_load_pd(b);
+		b1 = _mm_load_pd(b+2);
+		ak = _mm_set1_pd(a[0]);
+		c00 = _mm_add_pd(c00, _mm_mul_pd(ak, b0));
+		c01 = _mm_add_pd(c01, _mm_mul_pd(ak, b1));
+		ak = _mm_set1_pd(a[1]);
+		c10 = _mm_add_pd(c10, _mm_mul_pd(ak, b0));
+		c11 = _mm_add_pd(c11, _mm_mul_pd(ak, b1));
+		ak = _mm_set1_pd(a[2]);
+		c20 = _mm_add_pd(c20, _mm_mul_pd(ak, b0));
+		c21 = _mm_add_pd(c21, _mm_mul_pd(ak, b1));
+		ak = _mm_set1_pd(a[3]);
+		c30 = _mm_add_pd(c30, _mm_mul_pd(ak, b0));
+		c31 = _mm_add_pd(c31, _mm_mul_pd(ak, b1));
+	}
+	_mm_storeu_pd(c0,   _mm_add_pd(_mm_loadu_pd(c0),   c00));
+	_mm_storeu_pd(c0+2, _mm_add_pd(_mm_loadu_pd(c0+2), c01));
+	_mm_storeu_pd(c1,   _mm_add_pd(_mm_loadu_pd(c1),   c10));
+	_mm_storeu_pd(c1+2, _mm_add_pd(_mm_loadu_pd(c1+2), c11));
+	_mm_storeu_pd(c2,   _mm_add_pd(_mm_loadu_pd(c2),   c20));
+	_mm_storeu_pd(c2+2, _mm_add_pd(_mm_loadu_pd(c2+2), c21));
+	_mm_storeu_pd(c3,   _mm_add_pd(_mm_loadu_pd(c3),   c30));
+	_mm_storeu_pd(c3+2, _mm_add_pd(_mm_loadu_pd(c3+2), c31));
+}
+
+__attribute__((target("avx2,fma")))
+static void avx2_4x8(int kc, const double *restrict a, const double *restrict b, double *restrict c, int ldc)
+{
+	register int k;
+	__m256d c00, c01, c10, c11, c20, c21, c30, c31;
+	__m256d b0, b1, ak;
+	double *c0 = c, *c1 = c + ldc, *c2 = c + 2*(size_t)ldc, *c3 = c + 3*(size_t)ldc;
+
+	c00 = c01 = c10 = c11 = c20 = c21 = c30 = c31 = _mm256_setzero_pd();
+	for (k = 0; k < kc; k++, a += MR, b += 8) {
+		b0 = _mm256_load_pd(b);
+		b1 = _mm256_load_pd(b+4);
+		ak = _mm256_broadcast_sd(&a[0]);
+		c00 = _mm256_fmadd_pd(ak, b0, c00);
+		c01 = _mm256_fmadd_pd(ak, b1, c01);
+		ak = _mm256_broadcast_sd(&a[1]);
+		c10 = _mm256_fmadd_pd(ak, b0, c10);
+		c11 = _mm256_fmadd_pd(ak, b1, c11);
+		ak = _mm256_broadcast_sd(&a[2]);
+		c20 = _mm256_fmadd_pd(ak, b0, c20);
+		c21 = _mm256_fmadd_pd(ak, b1, c21);
+		ak = _mm256_broadcast_sd(&a[3]);
+		c30 = _mm256_fmadd_pd(ak, b0, c30);
+		c31 = _mm256_fmadd_pd(ak, b1, c31);
+	}
+	_mm256_storeu_pd(c0,   _mm256_add_pd(_mm256_loadu_pd(c0),   c00));
+	_mm256_storeu_pd(c0+4, _mm256_add_pd(_mm256_loadu_pd(c0+4), c01));
+	_mm256_storeu_pd(c1,   _mm256_add_pd(_mm256_loadu_pd(c1),   c10));
+	_mm256_storeu_pd(c1+4, _mm256_add_pd(_mm256_loadu_pd(c1+4), c11));
+	_mm256_storeu_pd(c2,   _mm256_add_pd(_mm256_loadu_pd(c2),   c20));
+	_mm256_storeu_pd(c2+4, _mm256_add_pd(_mm256_loadu_pd(c2+4), c21));
+	_mm256_storeu_pd(c3,   _mm256_add_pd(_mm256_loadu_pd(c3),   c30));
+	_mm256_storeu_pd(c3+4, _mm256_add_pd(_mm256_loadu_pd(c3+4), c31));
+}
+#endif
+
+static const struct kernel Kernels[] = {
+#ifdef HAVE_X86_SIMD
+	{ "avx2", MR, 8, avx2_4x8 },
+	{ "sse2", MR, 4, sse2_4x4 },
+#endif
+	{ "scalar", MR, 4, scalar_4x4 },
+	{ NULL, 0, 0, NULL }
+};
+
+/*
+ * returns non-zero if the CPU (as reported by cpuid) can run kernel k
+ */
+static int kernel_supported(const struct kernel *k)
+{
+#ifdef HAVE_X86_SIMD
+	__builtin_cpu_init();
+	if (strcmp(k->name, "avx2") == 0)
+		return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+	if (strcmp(k->name, "sse2") == 0)
+		return __builtin_cpu_supports("sse2");
+#endif
+	return 1;
+}
+
+/*
+ * "simd" means the fastest kernel this CPU supports (Kernels[] is ordered
+ * fastest first)
+ */
+static const struct kernel *select_kernel(const char *name)
+{
+	const struct kernel *k;
+
+	for (k = Kernels; k->name; k++) {
+		if ((strcmp(name, "simd") == 0 || strcmp(name, k->name) == 0) && kernel_supported(k))
+			return k;
+	}
+	return NULL;
+}
+
+/*
+ * Work-stealing deques (GEMM_SCHED_STEAL)
+ *   Each deque is a half-open range [lo, hi) of task indices packed into
+ *   one 64-bit word so that both ends can be updated with a single
+ *   compare-and-swap: the owner pops tasks off lo, thieves take half of the
+ *   remaining tasks off hi. Deques sit on their own cache lines.
+ */
+#define RANGE(lo,hi) (((unsigned long long)(lo) << 32) | (unsigned long long)(hi))
+#define RANGE_LO(r) ((unsigned)((r) >> 32))
+#define RANGE_HI(r) ((unsigned)((r) & 0xffffffffULL))
+
+struct deque
+{
+	atomic_ullong range;
+	char pad[CACHE_LINE - sizeof(atomic_ullong)];
+};
+
+/*
+ * Persistent thread pool
+ *   A job is published by bumping generation; idle workers spin on it for
+ *   a while and then sleep on it (futex). pending counts the workers still
+ *   busy with the current job and the last one to finish wakes the caller.
+ *   sleepers lets the caller skip the wake-up system call when every worker
+ *   is still spinning.
+ */
+#define POOL_SPINS 20000
+
+struct worker
+{
+	struct gemm_context *ctx;
+	int id;
+	double *apack;	/* packed mc x kc panel of op(A) */
+	double *bpack;	/* packed kc x nc panel of op(B) */
+	size_t apack_len, bpack_len;	/* their sizes in doubles */
+	struct gemm_stats stats;
+} __attribute__((aligned(CACHE_LINE)));
+
+/*
+ * one gemm_dgemm() call, reduced to row-major: element (i,p) of op(A) is
+ * a[i*rsa + p*csa] and element (p,j) of op(B) is b[p*rsb + j*csb]
+ */
+struct problem
+{
+	int m, n, k;
+	double alpha, beta;
+	const double *a, *b;
+	long rsa, csa, rsb, csb;
+	double *c;
+	int ldc;
+	unsigned long long tile_cols;
+};
+
+struct gemm_context
+{
+	const struct kernel *kernel;	/* NULL for "dot" */
+	int mc, nc, kc;
+	enum gemm_sched sched;
+	int nthreads;	/* pool workers; 0 runs on the caller */
+	int nworkers;	/* MAX(nthreads, 1) */
+	struct worker *workers;
+	pthread_t *threads;
+	pthread_mutex_t lock;	/* one call at a time */
+
+	/* the current job */
+	void (*job)(struct worker *w, void *arg);
+	void *arg;
+	atomic_int generation;
+	atomic_int pending;
+	atomic_int sleepers;
+	atomic_int shutdown;
+	atomic_int failed;
+
+	/* task dispenser */
+	atomic_ullong next_task;
+	unsigned long long ntasks;
+	struct deque *deques;
+};
+
+static double seconds_now(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double)now.tv_sec + 1e-9 * now.tv_nsec;
+}
+
+/*
+ * futex-style wait/wake on an atomic int: futex_wait() sleeps only while
+ * *addr still equals val, futex_wake() wakes up to n sleepers. Elsewhere
+ * the wait degrades to a yield and the caller's loop re-checks the value.
+ */
+static void futex_wait(atomic_int *addr, int val)
+{
+#ifdef __linux__
+	syscall(SYS_futex, (int *)addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+#else
+	sched_yield();
+#endif
+}
+
+static void futex_wake(atomic_int *addr, int n)
+{
+#ifdef __linux__
+	syscall(SYS_futex, (int *)addr, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+#endif
+}
+
+static inline void cpu_relax(void)
+{
+#ifdef HAVE_X86_SIMD
+	_mm_pause();
+#else
+	sched_yield();
+#endif
+}
+
+static void *pool_worker(void *tharg)
+{
+	struct worker *w = (struct worker *)tharg;
+	struct gemm_context *ctx = w->ctx;
+	int seen = 0, gen, spins;
+	cpu_set_t set;
+
+	if (w->stats.cpu >= 0) {
+		CPU_ZERO(&set);
+		CPU_SET(w->stats.cpu, &set);
+		if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+			w->stats.cpu = -1;
+	}
+
+	for (;;) {
+		//
+		// Spin, then sleep, until a new job is published
+		//
+		for (spins = 0; (gen = atomic_load(&ctx->generation)) == seen; spins++) {
+			if (spins < POOL_SPINS) {
+				cpu_relax();
+			}
+			else {
+				atomic_fetch_add(&ctx->sleepers, 1);
+				futex_wait(&ctx->generation, seen);
+				atomic_fetch_sub(&ctx->sleepers, 1);
+			}
+		}
+		seen = gen;
+		if (atomic_load(&ctx->shutdown))
+			break;
+		ctx->job(w, ctx->arg);
+		if (atomic_fetch_sub(&ctx->pending, 1) == 1)
+			futex_wake(&ctx->pending, 1);
+	}
+	return NULL;
+}
+
+/*
+ * run job(w, arg) once on every worker and wait for all of them; with no
+ * pool the caller is worker 0. ctx->lock is held by the caller.
+ */
+static void dispatch(struct gemm_context *ctx, void (*job)(struct worker *, void *), void *arg)
+{
+	int n, spins;
+
+	if (ctx->nthreads == 0) {
+		job(&ctx->workers[0], arg);
+		return;
+	}
+	ctx->job = job;
+	ctx->arg = arg;
+	atomic_store(&ctx->pending, ctx->nthreads);
+	atomic_fetch_add(&ctx->generation, 1);
+	if (atomic_load(&ctx->sleepers) > 0)
+		futex_wake(&ctx->generation, INT_MAX);
+	for (spins = 0; (n = atomic_load(&ctx->pending)) > 0; spins++) {
+		if (spins < POOL_SPINS)
+			cpu_relax();
+		else
+			futex_wait(&ctx->pending, n);
+	}
+}
+
+struct gemm_context *gemm_create(int nthreads, const int *cpus, const char *kernel)
+{
+	struct gemm_context *ctx;
+	int i;
+
+	if (nthreads < 0)
+		return NULL;
+	if ((ctx = (struct gemm_context *)calloc(1, sizeof(*ctx))) == NULL)
+		return NULL;
+	if (kernel != NULL && strcmp(kernel, "dot") != 0 && (ctx->kernel = select_kernel(kernel)) == NULL) {
+		free(ctx);
+		return NULL;
+	}
+	ctx->mc = ctx->nc = ctx->kc = DEFAULT_BLOCK;
+	ctx->sched = GEMM_SCHED_SHARED;
+	ctx->nthreads = nthreads;
+	ctx->nworkers = MAX(nthreads, 1);
+	ctx->workers = (struct worker *)memalign(CACHE_LINE, ctx->nworkers * sizeof(struct worker));
+	ctx->deques = (struct deque *)memalign(CACHE_LINE, ctx->nworkers * sizeof(struct deque));
+	ctx->threads = (pthread_t *)malloc(ctx->nworkers * sizeof(pthread_t));
+	if (ctx->workers == NULL || ctx->deques == NULL || ctx->threads == NULL) {
+		free(ctx->workers);
+		free(ctx->deques);
+		free(ctx->threads);
+		free(ctx);
+		return NULL;
+	}
+	memset(ctx->workers, 0, ctx->nworkers * sizeof(struct worker));
+	pthread_mutex_init(&ctx->lock, NULL);
+	atomic_init(&ctx->generation, 0);
+	atomic_init(&ctx->pending, 0);
+	atomic_init(&ctx->sleepers, 0);
+	atomic_init(&ctx->shutdown, 0);
+	atomic_init(&ctx->failed, 0);
+	atomic_init(&ctx->next_task, 0);
+	for (i = 0; i < ctx->nworkers; i++) {
+		ctx->workers[i].ctx = ctx;
+		ctx->workers[i].id = i;
+		ctx->workers[i].stats.cpu = (cpus != NULL && nthreads > 0) ? cpus[i] : -1;
+	}
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&ctx->threads[i], NULL, pool_worker, &ctx->workers[i]) != 0) {
+			ctx->nthreads = i;
+			gemm_destroy(ctx);
+			return NULL;
+		}
+	}
+	return ctx;
+}
+
+/*
+ * stop and join the pool workers and free everything
+ */
+void gemm_destroy(struct gemm_context *ctx)
+{
+	int i;
+
+	if (ctx == NULL)
+		return;
+	if (ctx->nthreads > 0) {
+		atomic_store(&ctx->shutdown, 1);
+		atomic_fetch_add(&ctx->generation, 1);
+		futex_wake(&ctx->generation, INT_MAX);
+		for (i = 0; i < ctx->nthreads; i++)
+			pthread_join(ctx->threads[i], NULL);
+	}
+	for (i = 0; i < ctx->nworkers; i++) {
+		free(ctx->workers[i].apack);
+		free(ctx->workers[i].bpack);
+	}
+	pthread_mutex_destroy(&ctx->lock);
+	free(ctx->workers);
+	free(ctx->deques);
+	free(ctx->threads);
+	free(ctx);
+}
+
+const char *gemm_kernel(const struct gemm_context *ctx, int *mr, int *nr)
+{
+	if (mr) *mr = ctx->kernel ? ctx->kernel->mr : 0;
+	if (nr) *nr = ctx->kernel ? ctx->kernel->nr : 0;
+	return ctx->kernel ? ctx->kernel->name : "dot";
+}
+
+void gemm_set_blocking(struct gemm_context *ctx, int mc, int nc, int kc)
+{
+	pthread_mutex_lock(&ctx->lock);
+	ctx->mc = (mc > 0) ? mc : DEFAULT_BLOCK;
+	ctx->nc = (nc > 0) ? nc : DEFAULT_BLOCK;
+	ctx->kc = (kc > 0) ? kc : DEFAULT_BLOCK;
+	pthread_mutex_unlock(&ctx->lock);
+}
+
+void gemm_set_scheduler(struct gemm_context *ctx, enum gemm_sched sched)
+{
+	pthread_mutex_lock(&ctx->lock);
+	ctx->sched = sched;
+	pthread_mutex_unlock(&ctx->lock);
+}
+
+int gemm_threads(const struct gemm_context *ctx)
+{
+	return ctx->nthreads;
+}
+
+void gemm_get_stats(const struct gemm_context *ctx, int id, struct gemm_stats *st)
+{
+	*st = ctx->workers[id].stats;
+}
+
+void gemm_reset_stats(struct gemm_context *ctx)
+{
+	int i, cpu;
+
+	pthread_mutex_lock(&ctx->lock);
+	for (i = 0; i < ctx->nworkers; i++) {
+		cpu = ctx->workers[i].stats.cpu;
+		memset(&ctx->workers[i].stats, 0, sizeof(struct gemm_stats));
+		ctx->workers[i].stats.cpu = cpu;
+	}
+	pthread_mutex_unlock(&ctx->lock);
+}
+
+/*
+ * Task scheduling
+ *   Shared: a worker claims the next task with a single fetch-add, so no
+ *   lock is taken per task. Steal: every worker starts with a contiguous
+ *   run of task indices (for C tiles, a band of whole tile rows, so it
+ *   reuses its own rows of A against every panel of B) and steals from the
+ *   others when it runs dry.
+ */
+static void reset_tasks(struct gemm_context *ctx, unsigned long long ntasks)
+{
+	unsigned long long lo, hi;
+	int i;
+
+	ctx->ntasks = ntasks;
+	atomic_store(&ctx->next_task, 0);
+	if (ctx->sched == GEMM_SCHED_STEAL) {
+		for (i = 0; i < ctx->nworkers; i++) {
+			lo = ntasks * i / ctx->nworkers;
+			hi = ntasks * (i + 1) / ctx->nworkers;
+			atomic_store(&ctx->deques[i].range, RANGE(lo, hi));
+		}
+	}
+}
+
+/*
+ * pop the next task off the front of our own deque, or when it is empty
+ * steal the back half of the first victim that still has work. Returns
+ * the task index, or -1 when every deque is empty.
+ */
+static long long steal_task(struct worker *w)
+{
+	struct gemm_context *ctx = w->ctx;
+	unsigned long long r, nr;
+	unsigned lo, hi, take;
+	int v, victim;
+	atomic_ullong *mine = &ctx->deques[w->id].range;
+
+	r = atomic_load(mine);
+	while ((lo = RANGE_LO(r)) < (hi = RANGE_HI(r))) {
+		if (atomic_compare_exchange_weak(mine, &r, RANGE(lo + 1, hi)))
+			return lo;
+	}
+	for (v = 1; v < ctx->nworkers; v++) {
+		victim = (w->id + v) % ctx->nworkers;
+		r = atomic_load(&ctx->deques[victim].range);
+		while ((lo = RANGE_LO(r)) < (hi = RANGE_HI(r))) {
+			take = (hi - lo + 1) / 2;
+			nr = RANGE(lo, hi - take);
+			if (atomic_compare_exchange_weak(&ctx->deques[victim].range, &r, nr)) {
+				//
+				// Run the first stolen task now and publish the rest in
+				// our (empty) deque where others can steal them in turn.
+				//
+				atomic_store(mine, RANGE(hi - take + 1, hi));
+				w->stats.steals++;
+				return hi - take;
+			}
+		}
+	}
+	return -1;
+}
+
+/*
+ * claim the next task; returns -1 when there are none left
+ */
+static long long next_task(struct worker *w)
+{
+	unsigned long long t;
+
+	if (w->ctx->sched == GEMM_SCHED_STEAL)
+		return steal_task(w);
+	t = atomic_fetch_add_explicit(&w->ctx->next_task, 1, memory_order_relaxed);
+	return (t < w->ctx->ntasks) ? (long long)t : -1;
+}
+
+/*
+ * Panel packing (GotoBLAS style)
+ *   pack_a() copies the m x kc panel of alpha * op(A) at a into slivers of
+ *   mr rows, each stored column by column; pack_b() copies the kc x n panel
+ *   of op(B) at b into slivers of nr columns, each stored row by row.
+ *   Slivers are padded with zeros out to a full mr or nr so the
+ *   micro-kernel never sees a ragged edge. The strides make transposed and
+ *   column-major operands cost nothing extra here, and the buffers are
+ *   contiguous and aligned, so the kernel's k loop touches a handful of
+ *   pages instead of one page per row of A and B.
+ */
+static void pack_a(double *restrict ap, int mr, const double *restrict a, long rs, long cs, int m, int kc, double alpha)
+{
+	register int i, k, r;
+
+	for (i = 0; i < m; i += mr) {
+		for (k = 0; k < kc; k++) {
+			for (r = 0; r < mr; r++)
+				*ap++ = (i+r < m) ? alpha * a[(i+r)*rs + k*cs] : 0.0;
+		}
+	}
+}
+
+static void pack_b(double *restrict bp, int nr, const double *restrict b, long rs, long cs, int kc, int n)
+{
+	register int j, k, q;
+
+	for (j = 0; j < n; j += nr) {
+		for (k = 0; k < kc; k++) {
+			for (q = 0; q < nr; q++)
+				*bp++ = (j+q < n) ? b[k*rs + (j+q)*cs] : 0.0;
+		}
+	}
+}
+
+/*
+ * sweep the micro-kernel over w's packed panels, computing the m x n block
+ * at c (row stride ldc) += apack * bpack. Tiles that hang off the edge of
+ * the block are computed into a scratch tile and added back.
+ */
+static void kernel_sweep(struct worker *w, int m, int n, int kc, double *c, int ldc)
+{
+	const struct kernel *kern = w->ctx->kernel;
+	register int i, j, r, q;
+	int mr = kern->mr, nr = kern->nr;
+	double edge[MR][NRMAX];
+	const double *ap, *bp;
+	double *crow;
+
+	for (i = 0, ap = w->apack; i < m; i += mr, ap += mr*kc) {
+		crow = c + (size_t)i*ldc;
+		for (j = 0, bp = w->bpack; j < n; j += nr, bp += nr*kc) {
+			if (i+mr <= m && j+nr <= n) {
+				kern->tile(kc, ap, bp, crow + j, ldc);
+			}
+			else {
+				memset(edge, 0, sizeof(edge));
+				kern->tile(kc, ap, bp, &edge[0][0], NRMAX);
+				for (r = 0; r < mr && i+r < m; r++)
+					for (q = 0; q < nr && j+q < n; q++)
+						crow[(size_t)r*ldc + j+q] += edge[r][q];
+			}
+		}
+	}
+}
+
+/*
+ * c[0:m][0:n] += alpha * a[0:m][0:kc] * b[0:kc][0:n], one dot product per
+ * element of c ("dot")
+ */
+static void dot_block(const struct problem *p, const double *restrict a, const double *restrict b, int m, int n, int kc,
+                      double *restrict c)
+{
+	register int i, j, k;
+	double sum;
+
+	for (i = 0; i < m; i++) {
+		for (j = 0; j < n; j++) {
+			sum = 0.0;
+			for (k = 0; k < kc; k++) {
+				sum += a[i*p->rsa + k*p->csa] * b[k*p->rsb + j*p->csb];
+			}
+			c[(size_t)i*p->ldc + j] += p->alpha * sum;
+		}
+	}
+}
+
+/*
+ * make sure w's packing buffers can hold one mc x kc panel of A and one
+ * kc x nc panel of B; they are only reallocated when the blocking grows.
+ * Each worker allocates its own, so they are first touched (and placed)
+ * by the thread that uses them.
+ */
+static int alloc_packs(struct worker *w)
+{
+	struct gemm_context *ctx = w->ctx;
+	size_t alen = (size_t)(ctx->mc+MR-1)/MR*MR*ctx->kc;
+	size_t blen = (size_t)(ctx->nc+NRMAX-1)/NRMAX*NRMAX*ctx->kc;
+
+	if (w->apack != NULL && alen <= w->apack_len && blen <= w->bpack_len)
+		return 0;
+	free(w->apack);
+	free(w->bpack);
+	w->apack = (double *) memalign(PACK_ALIGN, alen*sizeof(double));
+	w->bpack = (double *) memalign(PACK_ALIGN, blen*sizeof(double));
+	w->apack_len = alen;
+	w->bpack_len = blen;
+	if (w->apack == NULL || w->bpack == NULL) {
+		free(w->apack);
+		free(w->bpack);
+		w->apack = w->bpack = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * C tile t: scale it by beta, then add alpha * op(A) * op(B) kc at a time
+ */
+static void compute_tile(struct worker *w, const struct problem *p, long long t)
+{
+	struct gemm_context *ctx = w->ctx;
+	int i0 = t / p->tile_cols * ctx->mc, j0 = t % p->tile_cols * ctx->nc;
+	int m = MIN(ctx->mc, p->m - i0), n = MIN(ctx->nc, p->n - j0);
+	int i, j, kk, kc;
+	double *c = p->c + (size_t)i0*p->ldc + j0;
+	const double *a, *b;
+
+	if (p->beta != 1.0) {
+		for (i = 0; i < m; i++)
+			for (j = 0; j < n; j++)
+				c[(size_t)i*p->ldc + j] = (p->beta == 0.0) ? 0.0 : p->beta * c[(size_t)i*p->ldc + j];
+	}
+	if (p->alpha == 0.0)
+		return;
+	for (kk = 0; kk < p->k; kk += ctx->kc) {
+		kc = MIN(ctx->kc, p->k - kk);
+		a = p->a + i0*p->rsa + kk*p->csa;
+		b = p->b + kk*p->rsb + j0*p->csb;
+		if (ctx->kernel == NULL) {
+			dot_block(p, a, b, m, n, kc, c);
+		}
+		else {
+			pack_b(w->bpack, ctx->kernel->nr, b, p->rsb, p->csb, kc, n);
+			pack_a(w->apack, ctx->kernel->mr, a, p->rsa, p->csa, m, kc, p->alpha);
+			kernel_sweep(w, m, n, kc, c, p->ldc);
+		}
+		w->stats.bytes += sizeof(double) * ((double)m*kc + (double)kc*n);
+	}
+	w->stats.flops += 2.0 * m * n * p->k;
+	w->stats.bytes += 2.0 * sizeof(double) * m * n;
+}
+
+static void dgemm_job(struct worker *w, void *arg)
+{
+	const struct problem *p = (const struct problem *)arg;
+	double start = seconds_now();
+	long long t;
+
+	if (w->ctx->kernel != NULL && alloc_packs(w) != 0) {
+		atomic_store(&w->ctx->failed, 1);
+		return;
+	}
+	while ((t = next_task(w)) >= 0)
+		compute_tile(w, p, t);
+	w->stats.busy += seconds_now() - start;
+}
+
+int gemm_dgemm(struct gemm_context *ctx, enum gemm_order order, enum gemm_trans transa, enum gemm_trans transb,
+               int m, int n, int k, double alpha, const double *a, int lda, const double *b, int ldb,
+               double beta, double *c, int ldc)
+{
+	struct problem p;
+	const double *t;
+	int tt, status;
+
+	//
+	// A column-major product is the row-major product of the transposes,
+	// C' = op(B)' * op(A)', and a column-major matrix read row-major is
+	// its transpose; so swap the operands and the sizes, keep the flags
+	//
+	if (order == GEMM_COL_MAJOR) {
+		t = a; a = b; b = t;
+		tt = lda; lda = ldb; ldb = tt;
+		tt = transa; transa = transb; transb = tt;
+		tt = m; m = n; n = tt;
+	}
+	if (m < 0 || n < 0 || k < 0 ||
+	    lda < MAX(1, (transa == GEMM_TRANS) ? m : k) ||
+	    ldb < MAX(1, (transb == GEMM_TRANS) ? k : n) ||
+	    ldc < MAX(1, n))
+		return -1;
+	if (m == 0 || n == 0)
+		return 0;
+
+	p.m = m;
+	p.n = n;
+	p.k = (alpha == 0.0) ? 0 : k;
+	p.alpha = (p.k == 0) ? 0.0 : alpha;
+	p.beta = beta;
+	p.a = a;
+	p.b = b;
+	p.rsa = (transa == GEMM_TRANS) ? 1 : lda;
+	p.csa = (transa == GEMM_TRANS) ? lda : 1;
+	p.rsb = (transb == GEMM_TRANS) ? 1 : ldb;
+	p.csb = (transb == GEMM_TRANS) ? ldb : 1;
+	p.c = c;
+	p.ldc = ldc;
+
+	pthread_mutex_lock(&ctx->lock);
+	p.tile_cols = (n + ctx->nc - 1) / ctx->nc;
+	atomic_store(&ctx->failed, 0);
+	reset_tasks(ctx, p.tile_cols * ((m + ctx->mc - 1) / ctx->mc));
+	dispatch(ctx, dgemm_job, &p);
+	status = atomic_load(&ctx->failed) ? -1 : 0;
+	pthread_mutex_unlock(&ctx->lock);
+	return status;
+}
+
+/*
+ * caller jobs: the user's function and its argument, timed as busy time
+ */
+struct user_job
+{
+	void (*job)(void *arg, int id);
+	void (*task)(void *arg, int id, long long t);
+	void *arg;
+};
+
+static void run_job(struct worker *w, void *arg)
+{
+	struct user_job *u = (struct user_job *)arg;
+	double start = seconds_now();
+
+	u->job(u->arg, w->id);
+	w->stats.busy += seconds_now() - start;
+}
+
+static void run_tasks(struct worker *w, void *arg)
+{
+	struct user_job *u = (struct user_job *)arg;
+	double start = seconds_now();
+	long long t;
+
+	while ((t = next_task(w)) >= 0)
+		u->task(u->arg, w->id, t);
+	w->stats.busy += seconds_now() - start;
+}
+
+void gemm_run(struct gemm_context *ctx, void (*job)(void *arg, int id), void *arg)
+{
+	struct user_job u = { job, NULL, arg };
+
+	pthread_mutex_lock(&ctx->lock);
+	dispatch(ctx, run_job, &u);
+	pthread_mutex_unlock(&ctx->lock);
+}
+
+void gemm_parallel_for(struct gemm_context *ctx, long long ntasks,
+                       void (*task)(void *arg, int id, long long t), void *arg)
+{
+	struct user_job u = { NULL, task, arg };
+
+	pthread_mutex_lock(&ctx->lock);
+	reset_tasks(ctx, (ntasks > 0) ? ntasks : 0);
+	dispatch(ctx, run_tasks, &u);
+	pthread_mutex_unlock(&ctx->lock);
+}
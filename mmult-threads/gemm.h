@@ -0,0 +1,90 @@
+/*
+ * gemm.h -- threaded, blocked double-precision matrix multiply
+ *
+ *   C = alpha * op(A) * op(B) + beta * C
+ *
+ * where op(X) is X or its transpose, op(A) is m x k, op(B) is k x n and C
+ * is m x n. Every matrix is a flat buffer in row- or column-major order
+ * with its own leading dimension (the distance between the starts of
+ * consecutive rows, or columns in column-major order).
+ *
+ * All state lives in a struct gemm_context: its kernel, blocking, tile
+ * scheduler and thread pool. Separate contexts can multiply concurrently;
+ * calls on the same context are serialized. A context created with
+ * nthreads > 0 owns that many persistent workers, which do all of the work
+ * while the caller waits; with nthreads == 0 everything runs on the
+ * calling thread (a cheap per-thread workspace for callers that do their
+ * own threading).
+ *
+ * Kernels are named as in mmult -m: "dot" (unpacked dot products),
+ * "scalar", "sse2", "avx2", or "simd" for the fastest one the CPU supports.
+ */
+
+#ifndef GEMM_H
+#define GEMM_H
+
+enum gemm_order { GEMM_ROW_MAJOR, GEMM_COL_MAJOR };
+enum gemm_trans { GEMM_NO_TRANS, GEMM_TRANS };
+enum gemm_sched { GEMM_SCHED_SHARED, GEMM_SCHED_STEAL };
+
+struct gemm_context;
+
+/*
+ * per-worker counters, accumulated until gemm_reset_stats()
+ */
+struct gemm_stats
+{
+	double busy;	/* seconds spent in jobs */
+	double flops;	/* floating-point operations of gemm_dgemm() */
+	double bytes;	/* bytes of A, B and C moved through the kernels */
+	unsigned steals;	/* successful steals (GEMM_SCHED_STEAL) */
+	int cpu;	/* core the worker is pinned to, or -1 */
+};
+
+/*
+ * create a context with the named kernel and nthreads workers; worker i is
+ * pinned to core cpus[i] when cpus is given and cpus[i] >= 0. Returns NULL
+ * if the kernel is unknown or not supported on this CPU, or on failure to
+ * allocate or start the workers.
+ */
+struct gemm_context *gemm_create(int nthreads, const int *cpus, const char *kernel);
+void gemm_destroy(struct gemm_context *ctx);
+
+/*
+ * the kernel actually selected and its register tile (0 x 0 for "dot")
+ */
+const char *gemm_kernel(const struct gemm_context *ctx, int *mr, int *nr);
+
+/*
+ * cache blocking: C is computed in mc x nc tiles, kc deep at a time
+ * (default 32 each); the scheduler decides which worker gets which tile
+ */
+void gemm_set_blocking(struct gemm_context *ctx, int mc, int nc, int kc);
+void gemm_set_scheduler(struct gemm_context *ctx, enum gemm_sched sched);
+
+/*
+ * C = alpha * op(A) * op(B) + beta * C. With beta == 0, C need not be
+ * initialized; C must not overlap A or B. Returns 0, or -1 for bad arguments or when the packing
+ * buffers cannot be allocated.
+ */
+int gemm_dgemm(struct gemm_context *ctx, enum gemm_order order, enum gemm_trans transa, enum gemm_trans transb,
+               int m, int n, int k, double alpha, const double *a, int lda, const double *b, int ldb,
+               double beta, double *c, int ldc);
+
+/*
+ * run job(arg, id) once on every worker (id 0 .. nthreads-1) and wait
+ */
+void gemm_run(struct gemm_context *ctx, void (*job)(void *arg, int id), void *arg);
+
+/*
+ * run task(arg, id, t) for t = 0 .. ntasks-1, each task on whichever
+ * worker the context's scheduler hands it to, and wait
+ */
+void gemm_parallel_for(struct gemm_context *ctx, long long ntasks,
+                       void (*task)(void *arg, int id, long long t), void *arg);
+
+int gemm_threads(const struct gemm_context *ctx);
+void gemm_get_stats(const struct gemm_context *ctx, int id, struct gemm_stats *st);
+void gemm_reset_stats(struct gemm_context *ctx);
+
+#endif
@@ -5,20 +5,38 @@
  * floating-point values from 0.0 to 0.999... and the computes the product
  * of A and B and then adds the result to C.
  *
+ * The multiply itself, its kernels and its thread pool are the gemm
+ * library (gemm.h, gemm.c); this program is the driver that times them.
+ *
  * bnoble - Thu, Jan 26, 2017 12:05:11 PM
  *
  */
 
+#define _GNU_SOURCE	/* sched_getaffinity(), pthread_setaffinity_np() */
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/time.h>
 #include <errno.h>
+#include <getopt.h>
 #include <pthread.h>
-#include <windows.h> /* needed for QueryPerformanceFrequency() and QueryPerformanceFrequency() */
+#include <sched.h>
+#include <string.h>
+#include <dirent.h>
+#include <limits.h>
+#include <math.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#include <malloc.h> /* memalign() */
+#include <time.h> /* clock_gettime() */
+#ifdef __linux__
+#include <linux/perf_event.h>
+#endif
+#include "gemm.h"
+#include "../matrix_mult/matfile.h"
 
-#define _64bit (sizeof(void*) == 8)
 #define	DEFAULT_NUMBER_OF_THREADS 1
 #define MAXTHREADS 64
 #define SQUARE(a) ((a)*(a))
@@ -28,34 +46,198 @@
  *   MIN/MAX -- See http://stackoverflow.com/questions/3437404/min-and-max-in-c
  */
 #define MIN(a,b) (((a)<(b))?(a):(b))
+#define PACK_ALIGN 64
+
+//
+// Matrices are flat: one page-aligned allocation with element (i,j) at
+// data[i*ld + j]. The leading dimension ld is the row length rounded up to
+// whole cache lines, and then to an odd number of them, so that rows never
+// start a multiple of 4 KB apart. Unpadded, every row of an N = 1024, 2048
+// or 4096 matrix maps to the same L1 sets and 4K-aliases its neighbours in
+// the load/store queues.
+//
+#define DOUBLES_PER_LINE 8
+
+struct matrix
+{
+	double *data;
+	int rows, cols;
+	int ld;	/* doubles between the starts of consecutive rows */
+	void *map;	/* the matrix file mapping data lies in (-L), or NULL */
+	size_t maplen;
+};
+
+/*
+ * row i of M, and element (i,j)
+ */
+#define ROW(M, i) ((M).data + (size_t)(i) * (M).ld)
+#define ELEM(M, i, j) (ROW(M, i)[j])
+
+//
+// Bump allocator for Strassen temporaries: a workspace reserved once and
+// handed out (and given back) stack fashion, so the recursion never calls
+// malloc()
+//
+struct arena
+{
+	double *base;
+	size_t size;	/* doubles */
+	size_t used;	/* doubles */
+};
+
+//
+// Hardware performance counters (-P)
+//   One set of perf_event_open(2) counters per thread (the main thread and
+//   every pool worker), counting user-mode events only. A counter the
+//   kernel or the CPU does not provide stays closed (fd -1) and is reported
+//   as n/a.
+//
+#define NCOUNTERS 5
+#define CNT_CYCLES 0
+#define CNT_INSTRUCTIONS 1
+#define CNT_L1D_MISSES 2
+#define CNT_LLC_MISSES 3
+#define CNT_DTLB_MISSES 4
+
+struct perf
+{
+	int fd[NCOUNTERS];
+};
+
+//
+// Timing phases reported by -P
+//
+#define PHASE_INIT 0
+#define PHASE_TUNE 1
+#define PHASE_MULTIPLY 2
+#define PHASE_OUTPUT 3
+#define NPHASES 4
+
+struct phase
+{
+	const char *name;
+	int used;
+	double start;
+	double seconds;
+	unsigned long long begin[NCOUNTERS];
+	unsigned long long count[NCOUNTERS];
+	int valid[NCOUNTERS];
+};
 
 //
-// Structure for passing arguments to threads
+// Per-thread state of the pool workers, for the algorithms mmult runs on
+// them itself (the block algorithm is all inside the gemm library)
 //
 struct thread_arg
 {
 	int id;
-	unsigned int row;
-	unsigned int col;
+	int cpu;	/* core this thread is pinned to, or -1 */
+	int node;	/* NUMA node of that core */
+	double flops;	/* floating-point operations performed */
+	double bytes;	/* bytes of A, B and C moved through the kernels */
+	struct gemm_context *seq;	/* this thread's own sequential multiplier */
+	struct arena arena;	/* Strassen workspace (-W) */
+	struct perf perf;	/* this thread's hardware counters (-P) */
+};
+
+//
+// Thread-to-core placement (-a)
+//   compact fills the cores of one NUMA node before moving to the next,
+//   scatter deals threads round-robin across the nodes.
+//
+#define AFFINITY_COMPACT 1
+#define AFFINITY_SCATTER 2
+#define MAXNODES 64
+#define FIRST_TOUCH_ROWS 64	/* rows of B per first-touch chunk */
+
+//
+// Recursive (cache-oblivious) algorithm (-c)
+//   C is first cut by recursive bisection into about TASKS_PER_THREAD tasks
+//   per thread, each a rectangle of C; the tasks are handed out like tiles.
+//   Every task then recurses on its largest dimension until the product is
+//   at most RECURSIVE_BASE on a side, which is passed to the block kernel.
+//
+#define RECURSIVE_BASE 64
+#define TASKS_PER_THREAD 4
+
+struct task
+{
+	int i0, m;
+	int j0, n;
+};
+struct task *Tasks;
+int Ntasks = 0;
+
+//
+// Strassen-Winograd algorithm (-W)
+//   Products larger than the crossover are split into seven half-size
+//   products with the Winograd schedule (15 additions); at or below it the
+//   packed block kernel takes over. Odd sizes are handled by peeling off the
+//   last row and column. The top levels of the recursion are expanded by
+//   main() into independent leaf products (enough to keep every thread
+//   busy) plus a list of fix-up steps run after the leaves are done; each
+//   leaf then recurses on its own with temporaries from its thread's arena.
+//
+#define STRASSEN_CROSSOVER 512
+#define ARENA_ALIGN 8	/* doubles, i.e. 64 bytes */
+
+struct view
+{
+	double *p;	/* element (i,j) is p[i*ld + j] */
+	int ld;
+};
+
+struct leaf
+{
+	int n;
+	struct view a, b, c;
 };
 
-struct
+#define STEP_COMBINE 1
+#define STEP_PEEL 2
+
+struct step
 {
-	pthread_mutex_t lock;
-	pthread_cond_t done;
-	unsigned long long int ops;
-	unsigned long long int next_row;
-	unsigned long long int next_col;
-}Work;
+	int kind;
+	int n;
+	struct view a, b, c;
+	struct view p[7];
+};
+
+struct leaf *Leaves;
+int Nleaves = 0;
+struct step *Steps;
+int Nsteps = 0;
+struct arena MainArena;
+
+//
+// Stride auto-tuner (--autotune)
+//   A coarse grid of {i,j,k} strides is timed first and the best point is
+//   then refined by coordinate search. Every trial is a short run of the
+//   block algorithm over just the first tiles of C (about
+//   AUTOTUNE_TRIAL_FLOPS of work), timed AUTOTUNE_REPEATS times. The winner
+//   is stored in the tuning database (TUNE_DB, or $MMULT_TUNE_DB) keyed by
+//   N, thread count, kernel and CPU model, where later -b runs without
+//   strides pick it up.
+//
+#define AUTOTUNE_TRIAL_FLOPS 5e8
+#define AUTOTUNE_REPEATS 3
+#define AUTOTUNE_ROUNDS 4
+#define TUNE_DB "mmult.tune"
 
 /*
  * Globals (not including getopt globals)
  *   These will have to be global when we make this program threaded.
  */
-double **A, **B, **C;
-long TimeCountStart;
-double Freq;
+struct matrix A, B, C;
+struct gemm_context *Ctx;
+struct thread_arg *Args;
+struct timespec TimeStart;
 double ElapsedTimeInSeconds;
+struct perf MainPerf;
+struct phase Phases[NPHASES] = {
+	{ "init" }, { "tune" }, { "multiply" }, { "output" }
+};
 
 /*
  * getopt globals
@@ -65,6 +247,12 @@ double ElapsedTimeInSeconds;
 int N = 0;
 int simple = 0;
 int block = 0;
+int recursive = 0;
+int strassen = 0;
+int crossover = 0;
+int errcheck = 0;
+int autotune = 0;
+int profile = 0;
 int istride = 0;
 int jstride = 0;
 int kstride = 0;
@@ -73,6 +261,13 @@ int debug = 0;
 int out = 0;
 int unity = 0;
 int unknown = 0;
+int steal = 0;
+int repeats = 1;
+int affinity = 0;
+char *kernel_name = NULL;
+char *load_prefix = NULL;
+char *save_prefix = NULL;
+const char *KernelName = "dot";	/* the kernel -m resolves to */
 unsigned Nthreads = DEFAULT_NUMBER_OF_THREADS;
 
 /*
@@ -81,6 +276,14 @@ unsigned Nthreads = DEFAULT_NUMBER_OF_THREADS;
  *
  * -s, execute the simple-sequential algorithm
  * -b, execute the block-sequential algorithm
+ * -c, execute the recursive (cache-oblivious) algorithm
+ * -W, execute the Strassen-Winograd algorithm
+ * -x <arg>, Strassen-Winograd crossover size (default STRASSEN_CROSSOVER)
+ * -e, check the result against the classic block algorithm and report the error
+ * -A, --autotune, search for the best {i,j,k} strides, save them in the
+ *     tuning database and then run the block algorithm with them
+ * -P, profile: per-phase time, GFLOP/s, per-thread busy time and, where
+ *     perf_event_open(2) allows, cycles, instructions and L1D/LLC/dTLB misses
  * -N <arg>, matrix size (NxN)
  * -i <arg>, where arg is i loop stride (default MIN(256/sizeof(double), N))
  * -j <arg>, where arg is j loop stride (default MIN(256/sizeof(double), N))
@@ -89,9 +292,38 @@ unsigned Nthreads = DEFAULT_NUMBER_OF_THREADS;
  * -d, turn on debug/diagnostic messages flag
  * -o, output the matrix values
  * -u, initialize the matrices with 1.0 (unity)
+ * -p <arg>, number of pthreads
+ * -m <arg>, block kernel: dot (default), simd (best available), avx2, sse2 or scalar
+ * -w <arg>, tile scheduler: shared (default) or steal
+ * -r <arg>, run the multiply arg times and report latency percentiles
+ * -a <arg>, pin threads to cores (compact or scatter) and initialize the
+ *           matrices in parallel, spreading their pages across the nodes
+ * -L <arg>, --load <arg>, map A, B and C from the matrix files <arg>a.mat,
+ *           <arg>b.mat and <arg>c.mat (see matfile.h) instead of generating
+ *           them; N comes from the files
+ * -S <arg>, --save <arg>, write A, B and C to <arg>a.mat, <arg>b.mat and
+ *           <arg>c.mat, and the final C to <arg>result.mat, one writer per
+ *           thread
  *
  */
-static char *options = "sbN:i:j:k:tdoup:";
+static char *options = "sbcWx:eAPN:i:j:k:tdoup:m:w:r:a:L:S:";
+static struct option long_options[] = {
+	{ "autotune", no_argument, NULL, 'A' },
+	{ "load", required_argument, NULL, 'L' },
+	{ "save", required_argument, NULL, 'S' },
+	{ NULL, 0, NULL, 0 }
+};
+
+/*
+ * <prefix><name>.mat
+ */
+char *matrix_path(const char *prefix, const char *name)
+{
+	static char path[PATH_MAX];
+
+	snprintf(path, sizeof(path), "%s%s.mat", prefix, name);
+	return path;
+}
 
 /*
  * parse the command-line arguments and check and report any errors
@@ -100,9 +332,10 @@ void parseargs(int argc, char *argv[])
 {
 	int c;
 	int badopt = 0;
+	struct matfile_header h;
 	char *progname = argv[0];
 
-	while ((c = getopt(argc, argv, options)) != -1) {
+	while ((c = getopt_long(argc, argv, options, long_options, NULL)) != -1) {
 		switch (c) {
 		case 's': /* execute the simple-sequential algorithm */
 			simple++;
@@ -110,6 +343,33 @@ void parseargs(int argc, char *argv[])
 		case 'b': /* execute the block-sequential algorithm */
 			block++;
 			break;
+		case 'c': /* execute the recursive cache-oblivious algorithm */
+			recursive++;
+			break;
+		case 'W': /* execute the Strassen-Winograd algorithm */
+			strassen++;
+			break;
+		case 'x': /* Strassen-Winograd crossover to the block kernel */
+			if ((crossover = atoi(optarg)) <= 0) {
+				printf("invalid crossover = %d\n", crossover);
+				badopt++;
+			}
+			break;
+		case 'e': /* compare against the classic algorithm */
+			errcheck++;
+			break;
+		case 'A': /* tune the block algorithm's strides */
+			autotune++;
+			break;
+		case 'P': /* per-phase profile */
+			profile++;
+			break;
+		case 'L': /* map the matrices from files */
+			load_prefix = optarg;
+			break;
+		case 'S': /* write the matrices to files */
+			save_prefix = optarg;
+			break;
 		case 'N': /* matrix size (NxN) */
 			if ((N = atoi(optarg)) <= 0) {
 				badopt++;
@@ -153,17 +413,92 @@ void parseargs(int argc, char *argv[])
 				badopt++;
 			}
 			break;
+		case 'm': /* inner kernel used by the block algorithm */
+			kernel_name = optarg;
+			break;
+		case 'w': /* tile scheduler used by the block algorithm */
+			if (strcmp(optarg, "steal") == 0) {
+				steal++;
+			}
+			else if (strcmp(optarg, "shared") != 0) {
+				printf("unknown scheduler %s\n", optarg);
+				badopt++;
+			}
+			break;
+		case 'a': /* thread-to-core pinning policy */
+			if (strcmp(optarg, "compact") == 0) {
+				affinity = AFFINITY_COMPACT;
+			}
+			else if (strcmp(optarg, "scatter") == 0) {
+				affinity = AFFINITY_SCATTER;
+			}
+			else {
+				printf("unknown affinity policy %s\n", optarg);
+				badopt++;
+			}
+			break;
+		case 'r': /* number of times to repeat the multiply */
+			if ((repeats = atoi(optarg)) <= 0) {
+				printf("invalid repeats = %d\n", repeats);
+				badopt++;
+			}
+			break;
 		default:
 			unknown++;
 			badopt++;
 		}
 	}
 
-	/* simple or block sequential algorithm must be specified */
-	if (((simple == 0)&&(block == 0))||((simple)&&(block))) {
-		printf("Must specify either -s (simple) or -b (block) sequential algorithm.\n");
+	/* autotuning is for the block algorithm, which it implies */
+	if ((autotune)&&(!simple)&&(!recursive)&&(!strassen)) {
+		block++;
+	}
+	if ((autotune)&&(!block)) {
+		printf("--autotune only tunes the block algorithm.\n");
+		badopt++;
+	}
+	if ((autotune)&&((istride)||(jstride)||(kstride))) {
+		printf("{i,j,k} block sizes are chosen by --autotune.\n");
+		badopt++;
+	}
+	/* exactly one of the simple, block or recursive algorithms must be specified */
+	if ((simple != 0) + (block != 0) + (recursive != 0) + (strassen != 0) != 1) {
+		printf("Must specify exactly one of -s (simple), -b (block), -c (recursive) or -W (Strassen-Winograd) algorithm.\n");
+		badopt++;
+	}
+	/* Strassen-Winograd options */
+	if ((crossover)&&(!strassen)) {
+		printf("-x crossover is only used by the Strassen-Winograd algorithm.\n");
+		badopt++;
+	}
+	if ((errcheck)&&(!strassen)) {
+		printf("-e error check is only used by the Strassen-Winograd algorithm.\n");
+		badopt++;
+	}
+	if ((strassen)&&(kernel_name)&&(strcmp(kernel_name, "dot") == 0)) {
+		printf("the Strassen-Winograd algorithm needs one of the packed (-m simd) kernels.\n");
 		badopt++;
 	}
+	if (crossover == 0) {
+		crossover = STRASSEN_CROSSOVER;
+	}
+	/* the loaded matrices give N */
+	if (load_prefix) {
+		if (matfile_read_header(matrix_path(load_prefix, "a"), &h) != 0) {
+			badopt++;
+		}
+		else if (N == 0) {
+			N = h.rows;
+		}
+		if (unity) {
+			printf("-u is not used with -L matrices.\n");
+			badopt++;
+		}
+		if ((save_prefix)&&(strcmp(load_prefix, save_prefix) == 0)) {
+			printf("-S would overwrite the matrices -L maps.\n");
+			badopt++;
+		}
+	}
 	/* sanity check on N */
 	if (N == 0) {
 		printf("N is required and must be greater than 0.\n");
@@ -174,24 +509,25 @@ void parseargs(int argc, char *argv[])
 		printf("{i,j,k} block sizes are not used in the simple sequential algorithm.\n");
 		badopt++;
 	}
-	/* if block sequential algorithm is used set the {i,j,k}stride values */
-	if (block) {
-		if ((!istride)||(!jstride)||(!kstride)) {
-			printf("note: using default block sizes:");
-			if (istride == 0)	{
-				istride = MIN(256/sizeof(double), N);
-				printf(" istride=%d",istride);
-			}
-			if (jstride == 0)	{
-				jstride = MIN(256/sizeof(double), N);
-				printf(" jstride=%d",jstride);
-			}
-			if (kstride == 0)	{
-				kstride = MIN(256/sizeof(double), N);
-				printf(" kstride=%d",kstride);
-			}
-			printf("\n");
-		}
+	if ((recursive)&&((istride)||(jstride)||(kstride))) {
+		printf("{i,j,k} block sizes are not used in the recursive algorithm.\n");
+		badopt++;
+	}
+	/* sanity check on the affinity policy */
+	if ((simple)&&(affinity)) {
+		printf("-a affinity is only used by the threaded algorithms.\n");
+		badopt++;
+	}
+	/* sanity check on the kernel selection */
+	if ((simple)&&(kernel_name)) {
+		printf("-m kernels are not used in the simple sequential algorithm.\n");
+		badopt++;
+	}
+	/* the block (and Strassen-Winograd base case) strides that were not */
+	/* given are filled in by main() from the tuning database or defaults */
+	/* the recursive algorithm's leaves are at most RECURSIVE_BASE on a side */
+	if (recursive) {
+		istride = jstride = kstride = MIN(RECURSIVE_BASE, N);
 	}
 	/* notify of any unknown command-line options */
 	if (unknown) {
@@ -200,67 +536,211 @@ void parseargs(int argc, char *argv[])
 	/* print a usage message for any bad command-line */
 	if (badopt || optind < argc) {
 		fprintf(stderr,
-		        "usage: %s -N size -b|-k [-i istride] [-j jstride] [-k kstride] [-t] [-o] [-d] [-u] [-p nthreads]\n",
+		        "usage: %s -N size -s|-b|-c|-W [-x crossover] [-e] [--autotune] [-P] [-i istride] [-j jstride] [-k kstride] [-t] [-o] [-d] [-u] [-p nthreads] [-m kernel] [-w scheduler] [-r repeats] [-a compact|scatter] [-L prefix] [-S prefix]\n",
 		        progname);
 		exit(0);
 	}
 }
 
+/*
+ * set the {i,j,k}stride values that were not given on the command line
+ */
+void default_strides(void)
+{
+	printf("note: using default block sizes:");
+	if (istride == 0)	{
+		istride = MIN(256/sizeof(double), N);
+		printf(" istride=%d",istride);
+	}
+	if (jstride == 0)	{
+		jstride = MIN(256/sizeof(double), N);
+		printf(" jstride=%d",jstride);
+	}
+	if (kstride == 0)	{
+		kstride = MIN(256/sizeof(double), N);
+		printf(" kstride=%d",kstride);
+	}
+	printf("\n");
+}
+
 /*
  * Initialize timing parameters
- * Based on: https://cygwin.com/ml/cygwin/2000-03/msg00579.html
  */
 void initialize_time(void)
 {
-	LARGE_INTEGER lFreq, lCnt;
-
-	QueryPerformanceFrequency(&lFreq);
-	Freq = (_64bit) ? (double)lFreq.QuadPart:(double)lFreq.LowPart;
-	QueryPerformanceCounter(&lCnt);
-	TimeCountStart = (_64bit) ? lCnt.QuadPart:lCnt.LowPart;
+	clock_gettime(CLOCK_MONOTONIC, &TimeStart);
 }
 
 void elapsed_time(void)
 {
-	LARGE_INTEGER lCnt;
-	long tcnt;
+	struct timespec now;
 
-	QueryPerformanceCounter(&lCnt);
-	tcnt = (_64bit) ? (lCnt.QuadPart - TimeCountStart):(lCnt.LowPart - TimeCountStart);
-	ElapsedTimeInSeconds = ((double)tcnt)/Freq;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ElapsedTimeInSeconds = (double)(now.tv_sec - TimeStart.tv_sec) + 1e-9 * (now.tv_nsec - TimeStart.tv_nsec);
 }
 
 /*
- * initialize matrices A, B, & C
+ * monotonic time in seconds; safe to call from any thread
  */
-void initialize(void)
+double seconds_now(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double)now.tv_sec + 1e-9 * now.tv_nsec;
+}
+
+/*
+ * open the calling thread's hardware counters
+ */
+void perf_open(struct perf *pc)
+{
+	int i;
+#ifdef __linux__
+	static const struct { unsigned type; unsigned long long config; } ev[NCOUNTERS] = {
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+		{ PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+		  (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+		{ PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL |
+		  (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+		{ PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+		  (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+	};
+	struct perf_event_attr attr;
+
+	for (i = 0; i < NCOUNTERS; i++) {
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = ev[i].type;
+		attr.config = ev[i].config;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		pc->fd[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	}
+#else
+	for (i = 0; i < NCOUNTERS; i++)
+		pc->fd[i] = -1;
+#endif
+}
+
+/*
+ * add pc's current counts to v[]
+ */
+void perf_read(struct perf *pc, unsigned long long v[NCOUNTERS])
+{
+	unsigned long long x;
+	int i;
+
+	for (i = 0; i < NCOUNTERS; i++) {
+		if (pc->fd[i] >= 0 && read(pc->fd[i], &x, sizeof(x)) == sizeof(x))
+			v[i] += x;
+	}
+}
+
+/*
+ * fill rows i0..I-1 of M with random values (or 1.0)
+ *   Every row has its own erand48() stream seeded from the row number and
+ *   the matrix, so the contents do not depend on which thread, or in what
+ *   order, the rows are filled.
+ */
+void fill_rows(struct matrix *M, int which, int i0, int I)
 {
 	int i, j;
-	double *p1;
-	double *p2;
-	double *p3;
+	unsigned short xsubi[3];
+	double *row;
+
+	for (i = i0; i < I; i++) {
+		row = ROW(*M, i);
+		xsubi[0] = 0x330E;
+		xsubi[1] = (unsigned short)(i ^ (which << 12));
+		xsubi[2] = (unsigned short)(i >> 4);
+		for (j = 0; j < N; j++)
+			row[j] = ((debug || unity) ? 1.0 : erand48(xsubi));
+	}
+}
 
-	A = (double **) malloc(N*sizeof(double *));
-	B = (double **) malloc(N*sizeof(double *));
-	C = (double **) malloc(N*sizeof(double *));
+/*
+ * leading dimension for rows of n doubles: whole cache lines, an odd
+ * number of them
+ */
+int padded_ld(int n)
+{
+	int lines = (n + DOUBLES_PER_LINE - 1) / DOUBLES_PER_LINE;
 
-	p1 = (double *) memalign(getpagesize(),N*N*sizeof(double));
-	p2 = (double *) memalign(getpagesize(),N*N*sizeof(double));
-	p3 = (double *) memalign(getpagesize(),N*N*sizeof(double));
+	if (lines % 2 == 0)
+		lines++;
+	return lines * DOUBLES_PER_LINE;
+}
 
-	for (i = 0 ; i < N; i++, p1 += N, p2 += N, p3 += N) {
-		A[i] = p1;
-		B[i] = p2;
-		C[i] = p3;
+/*
+ * allocate a rows x cols matrix in one page-aligned block; the pages are
+ * not touched here
+ */
+void matrix_alloc(struct matrix *m, int rows, int cols)
+{
+	m->rows = rows;
+	m->cols = cols;
+	m->ld = padded_ld(cols);
+	m->map = NULL;
+	m->data = (double *) memalign(getpagesize(), (size_t)rows*m->ld*sizeof(double));
+	if (m->data == NULL) {
+		printf("cannot allocate a %d x %d matrix\n", rows, cols);
+		exit(1);
 	}
+}
 
-	for (i = 0; i < N; i++) {
-		for (j = 0; j < N; j++) {
-			A[i][j] = ((debug || unity) ? 1.0 : drand48());
-			B[i][j] = ((debug || unity) ? 1.0 : drand48());
-			C[i][j] = ((debug || unity) ? 1.0 : drand48());
-		}
+/*
+ * allocate matrices A, B, & C
+ */
+void allocate(void)
+{
+	matrix_alloc(&A, N, N);
+	matrix_alloc(&B, N, N);
+	matrix_alloc(&C, N, N);
+}
+
+/*
+ * initialize matrices A, B, & C from the main thread
+ */
+void initialize(void)
+{
+	allocate();
+	fill_rows(&A, 0, 0, N);
+	fill_rows(&B, 1, 0, N);
+	fill_rows(&C, 2, 0, N);
+}
+
+/*
+ * map the -L file <name>.mat as the N x N matrix m. The payload is used in
+ * place, with the file's leading dimension; the mapping is private, so
+ * stores into C never reach the file.
+ */
+void load_matrix(struct matrix *m, const char *name)
+{
+	struct matfile_header h;
+	char *file = matrix_path(load_prefix, name);
+
+	if ((m->data = matfile_map(file, &h, &m->map, &m->maplen)) == NULL)
+		exit(1);
+	if (h.type != MATFILE_DOUBLE || h.layout != MATFILE_ROW_MAJOR || h.rows != N || h.cols != N) {
+		printf("%s: expected a %d x %d row-major double matrix\n", file, N, N);
+		exit(1);
 	}
+	m->rows = m->cols = N;
+	m->ld = h.ld;
+}
+
+/*
+ * write m to the -S file <name>.mat, padding and all, one writer per thread
+ */
+void save_matrix(struct matrix *m, const char *name)
+{
+	struct matfile_header h;
+
+	matfile_header_init(&h, MATFILE_DOUBLE, MATFILE_ROW_MAJOR, m->rows, m->cols, m->ld);
+	if (matfile_write(matrix_path(save_prefix, name), &h, m->data, Nthreads) != 0)
+		exit(1);
 }
 
 /*
@@ -270,153 +750,1155 @@ void simple_sequential(void)
 {
 	register int i, j, k;
 	double sum;
+	const double *restrict a = A.data, *restrict b = B.data;
+	double *restrict c = C.data;
+	size_t lda = A.ld, ldb = B.ld, ldc = C.ld;
 
 	for (i = 0; i < N; i++) {
 		for (j = 0; j < N; j++) {
 			sum = 0.0;
 			for (k = 0; k < N; k++) {
-				sum += A[i][k] * B[k][j];
+				sum += a[i*lda + k] * b[k*ldb + j];
 			}
-			C[i][j] += sum;
+			c[i*ldc + j] += sum;
 		}
 	}
 }
 
-
 /*
- * compute C += A * B using a simple cache aware block algorithm
+ * returns the NUMA node of cpu, found as the nodeX link in its sysfs
+ * directory (node 0 if there is none)
  */
-void* block_sequential(void* tharg)
+int cpu_node(int cpu)
 {
-	register int i, j, k, kk;
-	struct thread_arg *myarg = (struct thread_arg*)tharg;
-	double sum;
-	int I, J, K;
+	char path[64];
+	DIR *dir;
+	struct dirent *de;
+	int node = 0;
 
-	if (debug) printf("istride=%d, jstride=%d, kstride=%d\n",istride,jstride,kstride);
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+	if ((dir = opendir(path)) == NULL)
+		return 0;
+	while ((de = readdir(dir)) != NULL) {
+		if (strncmp(de->d_name, "node", 4) == 0 && sscanf(de->d_name + 4, "%d", &node) == 1)
+			break;
+	}
+	closedir(dir);
+	return (node < MAXNODES) ? node : 0;
+}
 
-	while(myarg->row < N)
-    {
-		for (kk = 0; kk < N; kk += kstride)
-        {
-			I = MIN(myarg->row+istride,N);
-			for (i = myarg->row; i < I; i++)
-            {
-				J = MIN(myarg->col+jstride,N);
-				for (j = myarg->col; j < J; j++)
-                {
-					K = MIN(kk+kstride,N);
-					sum = 0.0;
-					for (k = kk; k < K; k++)
-                    {
-						sum += A[i][k] * B[k][j];
-					}
-					C[i][j] += sum;
-				}
-			}
+/*
+ * choose a core (and node) for every pool worker according to policy
+ */
+void plan_affinity(struct thread_arg *args, unsigned nthreads, int policy)
+{
+	cpu_set_t set;
+	int ncpus = 0, nnodes = 0, cpu, node, i, n;
+	int *cpus, *nodes, *cpu_of;
+	int count[MAXNODES] = { 0 };
+	int used[MAXNODES] = { 0 };
+	int start[MAXNODES];
+
+	if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+		printf("sched_getaffinity: %s\n", strerror(errno));
+		return;
+	}
+	cpus = (int *)malloc(CPU_SETSIZE * sizeof(int));
+	nodes = (int *)malloc(CPU_SETSIZE * sizeof(int));
+	cpu_of = (int *)malloc(CPU_SETSIZE * sizeof(int));
+	//
+	// Look up each allowed cpu's node once, then order the cpus by node,
+	// then by cpu number
+	//
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (CPU_ISSET(cpu, &set)) {
+			cpu_of[ncpus] = cpu;
+			nodes[ncpus] = cpu_node(cpu);
+			if (count[nodes[ncpus]]++ == 0) nnodes++;
+			ncpus++;
+		}
+	}
+	if (ncpus == 0) {
+		printf("no cpus to pin to; threads are left unpinned\n");
+		free(cpus);
+		free(nodes);
+		free(cpu_of);
+		return;
+	}
+	for (node = 0, n = 0; node < MAXNODES; node++) {
+		start[node] = n;
+		n += count[node];
+	}
+	for (i = 0; i < ncpus; i++)
+		cpus[start[nodes[i]]++] = cpu_of[i];
+	for (node = 0, n = 0; node < MAXNODES; node++)
+		for (i = 0; i < count[node]; i++)
+			nodes[n++] = node;
+	for (i = 0; i < nthreads; i++) {
+		if (policy == AFFINITY_COMPACT) {
+			n = i % ncpus;
 		}
-		pthread_mutex_lock(&Work.lock);
-		Work.next_col += jstride;
-		if(Work.next_col > N)
-		{
-			Work.next_col = 0;
-			Work.next_row += istride;
+		else {
+			//
+			// i-th thread goes to the (i % nnodes)-th populated node, on
+			// the next core of that node not yet handed out
+			//
+			for (node = 0, n = i % nnodes; count[node] == 0 || n-- > 0; node++)
+				;
+			for (n = 0; nodes[n] != node; n++)
+				;
+			n += used[node]++ % count[node];
 		}
-		myarg->col = Work.next_col;
-		myarg->row = Work.next_row;
-		pthread_mutex_unlock(&Work.lock);
+		args[i].cpu = cpus[n];
+		args[i].node = nodes[n];
+		if (debug) printf("thread %d -> cpu %d (node %d)\n", i, cpus[n], nodes[n]);
 	}
-	pthread_mutex_lock(&Work.lock);
-	Work.ops--;
-	if (Work.ops == 0)
-		pthread_cond_signal(&Work.done);
-	pthread_mutex_unlock(&Work.lock);
-	pthread_exit(NULL);
+	free(cpus);
+	free(nodes);
+	free(cpu_of);
 }
 
-void printarray(double **A)
+/*
+ * Thread pool
+ *   The workers belong to the gemm context Ctx, created once by pool_init();
+ *   every job and every multiply reuses them. Args[i] is worker i's own
+ *   state for the jobs mmult hands them.
+ */
+
+/*
+ * run job(myarg) once on every pool worker and wait for all of them
+ */
+void job_trampoline(void *arg, int id)
 {
-	int i, j;
+	(*(void (**)(struct thread_arg *))arg)(&Args[id]);
+}
 
-	for (i = 0; i < N; i++) {
-		for (j = 0; j < N; j++) printf(" %0.1e", A[i][j]);
-		putchar('\n');
-	}
+void pool_run(void (*job)(struct thread_arg *))
+{
+	gemm_run(Ctx, job_trampoline, &job);
 }
 
-int main(int argc, char *argv[])
+/*
+ * start nthreads pool workers, pinned according to policy (0 = unpinned),
+ * running the named kernel
+ */
+void pool_init(unsigned nthreads, int policy, const char *kernel)
 {
-	int i;
-	pthread_t *threads;
-	struct thread_arg *tharg;
+	int i, *cpus;
 
-	parseargs(argc, argv);
-	if (debug) {
-		printf("System page size is %d\n",getpagesize());
-	}
-	initialize();
-	if (out) {
-		printf("A =\n");
-		printarray(A);
-		printf("B =\n");
-		printarray(B);
-		printf("C =\n");
-		printarray(C);
+	Args = (struct thread_arg *)calloc(nthreads, sizeof(struct thread_arg));
+	cpus = (int *)malloc(nthreads * sizeof(int));
+	for (i = 0; i < nthreads; i++) {
+		Args[i].id = i;
+		Args[i].cpu = -1;
+		memset(Args[i].perf.fd, -1, sizeof(Args[i].perf.fd));
 	}
-	if (simple) {
-		initialize_time();
-		simple_sequential();
-		elapsed_time();
-		if (timing) printf("%f\n",ElapsedTimeInSeconds);
+	if (policy)
+		plan_affinity(Args, nthreads, policy);
+	for (i = 0; i < nthreads; i++)
+		cpus[i] = Args[i].cpu;
+	if ((Ctx = gemm_create(nthreads, cpus, kernel)) == NULL) {
+		printf("kernel %s is unknown or not supported on this CPU\n", kernel);
+		exit(1);
 	}
-	else if (block) {
-		//
-		// Initalize the mutex locks
-		//
-		pthread_mutex_init(&Work.lock, NULL);
-		pthread_cond_init(&Work.done, NULL);
+	free(cpus);
+	gemm_set_scheduler(Ctx, steal ? GEMM_SCHED_STEAL : GEMM_SCHED_SHARED);
+}
 
-		//
-		// Initialize the other stuff
-		//
-		Work.ops = Nthreads;
-		Work.next_row = 0;
-		Work.next_col = 0;
-		threads = (pthread_t *)malloc(Nthreads * sizeof(pthread_t));
-		tharg = (struct thread_arg *)malloc(Nthreads * sizeof(struct thread_arg));
+/*
+ * pool job: a sequential multiplier of the pool's kernel and blocking for
+ * the recursive and Strassen-Winograd base cases, made by the thread that
+ * uses it so its buffers are first touched there
+ */
+void seq_attach(struct thread_arg *myarg)
+{
+	myarg->seq = gemm_create(0, NULL, KernelName);
+	gemm_set_blocking(myarg->seq, istride, jstride, kstride);
+}
 
-		//
-		// Initialize the thread arguments
-		//
-		for (i = 0; i < Nthreads; i++)
-		{
-			tharg[i].id = i;
-			tharg[i].row = Work.next_row;
-			tharg[i].col = Work.next_col;
-			Work.next_col += jstride;
-			if(Work.next_col > N)
-			{
-				Work.next_col = 0;
-				Work.next_row += istride;
-			}
-		}
+/*
+ * stop the pool workers
+ */
+void pool_shutdown(void)
+{
+	int i;
 
-		initialize_time();
-		for(i = 0; i < Nthreads; i++)
-		{
-			pthread_create(&threads[i], NULL, block_sequential, &tharg[i]);
-		}
-		pthread_mutex_lock(&Work.lock);
-		while (Work.ops > 0)
-			pthread_cond_wait(&Work.done, &Work.lock);
-		pthread_mutex_unlock(&Work.lock);
-		//block_sequential();
-		elapsed_time();
-		if (timing) printf("%f\n",ElapsedTimeInSeconds);
-	}
-	if (out) {
-		printf("C =\n");
-		printarray(C);
+	for (i = 0; i < Nthreads; i++)
+		gemm_destroy(Args[i].seq);
+	gemm_destroy(Ctx);
+	free(Args);
+}
+
+/*
+ * Profiling
+ */
+
+/*
+ * pool job: open the worker's own hardware counters
+ */
+void perf_attach(struct thread_arg *myarg)
+{
+	perf_open(&myarg->perf);
+}
+
+/*
+ * total counts over the main thread and every pool worker
+ */
+void counters_snapshot(unsigned long long v[NCOUNTERS])
+{
+	int i;
+
+	memset(v, 0, NCOUNTERS * sizeof(v[0]));
+	if (!profile)
+		return;
+	perf_read(&MainPerf, v);
+	for (i = 0; Args && i < Nthreads; i++)
+		perf_read(&Args[i].perf, v);
+}
+
+void phase_begin(int ph)
+{
+	Phases[ph].used = 1;
+	Phases[ph].start = seconds_now();
+	counters_snapshot(Phases[ph].begin);
+}
+
+void phase_end(int ph)
+{
+	unsigned long long now[NCOUNTERS];
+	int i;
+
+	Phases[ph].seconds += seconds_now() - Phases[ph].start;
+	counters_snapshot(now);
+	for (i = 0; i < NCOUNTERS; i++)
+		Phases[ph].count[i] += now[i] - Phases[ph].begin[i];
+}
+
+/*
+ * per-phase time, GFLOP/s of the multiply, counter rates, and per-thread
+ * busy time
+ */
+void print_profile(void)
+{
+	static const char *names[NCOUNTERS] = { "cycles", "instructions", "L1D", "LLC", "dTLB" };
+	struct phase *ph;
+	struct gemm_stats st;
+	double kinstr, mult = Phases[PHASE_MULTIPLY].seconds;
+	int p, i;
+
+	for (p = 0; p < NPHASES; p++) {
+		ph = &Phases[p];
+		if (!ph->used) continue;
+		printf("phase %-8s %f s", ph->name, ph->seconds);
+		if (p == PHASE_MULTIPLY)
+			printf(", %.3f GFLOP/s", 2.0 * N * N * (double)N * repeats / ph->seconds / 1e9);
+		if (MainPerf.fd[CNT_CYCLES] >= 0 && MainPerf.fd[CNT_INSTRUCTIONS] >= 0 && ph->count[CNT_CYCLES])
+			printf(", IPC %.2f", (double)ph->count[CNT_INSTRUCTIONS] / ph->count[CNT_CYCLES]);
+		if (MainPerf.fd[CNT_INSTRUCTIONS] >= 0 && ph->count[CNT_INSTRUCTIONS]) {
+			kinstr = ph->count[CNT_INSTRUCTIONS] / 1000.0;
+			printf(", misses/1k instructions:");
+			for (i = CNT_L1D_MISSES; i < NCOUNTERS; i++) {
+				if (MainPerf.fd[i] >= 0)
+					printf(" %s %.3f", names[i], ph->count[i] / kinstr);
+				else
+					printf(" %s n/a", names[i]);
+			}
+		}
+		putchar('\n');
+	}
+	if (profile && MainPerf.fd[CNT_CYCLES] < 0)
+		printf("note: hardware counters unavailable (perf_event_open: check perf_event_paranoid)\n");
+	for (i = 0; Ctx && i < Nthreads; i++) {
+		gemm_get_stats(Ctx, i, &st);
+		printf("thread %d: busy %f s (%.1f%% of multiply)\n", i, st.busy,
+		       (mult > 0.0) ? 100.0 * st.busy / mult : 0.0);
+	}
+}
+
+/*
+ * compute C += A * B using a simple cache aware block algorithm: C is cut
+ * into istride x jstride tiles, kstride deep at a time, which the pool
+ * computes with the selected kernel
+ */
+void block_multiply(void)
+{
+	if (debug) printf("istride=%d, jstride=%d, kstride=%d\n",istride,jstride,kstride);
+	gemm_dgemm(Ctx, GEMM_ROW_MAJOR, GEMM_NO_TRANS, GEMM_NO_TRANS, N, N, N,
+	           1.0, A.data, A.ld, B.data, B.ld, 1.0, C.data, C.ld);
+}
+
+
+/*
+ * split an extent of len in two, keeping the first half a multiple of 8
+ * (a whole number of micro-kernel tiles) where possible
+ */
+int split_half(int len)
+{
+	int h = len / 2;
+
+	return (h > 8) ? (h & ~7) : h;
+}
+
+/*
+ * cut C[i0:i0+m][j0:j0+n] into parts tasks by bisecting the larger side.
+ * Tasks are emitted in recursion order, so neighbouring task numbers are
+ * neighbouring regions of C.
+ */
+void make_tasks(int i0, int m, int j0, int n, int parts)
+{
+	int h;
+
+	if (parts <= 1 || (m <= RECURSIVE_BASE && n <= RECURSIVE_BASE)) {
+		Tasks[Ntasks].i0 = i0;
+		Tasks[Ntasks].m = m;
+		Tasks[Ntasks].j0 = j0;
+		Tasks[Ntasks].n = n;
+		Ntasks++;
+		return;
+	}
+	if (m >= n) {
+		h = split_half(m);
+		make_tasks(i0, h, j0, n, parts / 2);
+		make_tasks(i0 + h, m - h, j0, n, parts - parts / 2);
+	}
+	else {
+		h = split_half(n);
+		make_tasks(i0, m, j0, h, parts / 2);
+		make_tasks(i0, m, j0 + h, n - h, parts - parts / 2);
+	}
+}
+
+/*
+ * compute C[i0:i0+m][j0:j0+n] += A[i0:i0+m][k0:k0+k] * B[k0:k0+k][j0:j0+n]
+ * by halving the largest of m, n and k until the whole product fits in the
+ * base case. The halves of a k split update the same part of C and are done
+ * one after the other.
+ */
+void recursive_mult(struct thread_arg *myarg, int i0, int m, int j0, int n, int k0, int k)
+{
+	int h;
+
+	if (m <= RECURSIVE_BASE && n <= RECURSIVE_BASE && k <= RECURSIVE_BASE) {
+		gemm_dgemm(myarg->seq, GEMM_ROW_MAJOR, GEMM_NO_TRANS, GEMM_NO_TRANS, m, n, k,
+		           1.0, &ELEM(A, i0, k0), A.ld, &ELEM(B, k0, j0), B.ld, 1.0, &ELEM(C, i0, j0), C.ld);
+		myarg->flops += 2.0 * m * n * k;
+		myarg->bytes += sizeof(double) * ((double)m*k + (double)k*n + 2.0*m*n);
+		return;
+	}
+	if (m >= n && m >= k) {
+		h = split_half(m);
+		recursive_mult(myarg, i0, h, j0, n, k0, k);
+		recursive_mult(myarg, i0 + h, m - h, j0, n, k0, k);
+	}
+	else if (n >= k) {
+		h = split_half(n);
+		recursive_mult(myarg, i0, m, j0, h, k0, k);
+		recursive_mult(myarg, i0, m, j0 + h, n - h, k0, k);
+	}
+	else {
+		h = split_half(k);
+		recursive_mult(myarg, i0, m, j0, n, k0, h);
+		recursive_mult(myarg, i0, m, j0, n, k0 + h, k - h);
+	}
+}
+
+/*
+ * one task of the recursive algorithm; the pool's scheduler hands the
+ * tasks out to the workers
+ */
+void recursive_task(void *arg, int id, long long tn)
+{
+	struct task *t = &Tasks[tn];
+
+	recursive_mult(&Args[id], t->i0, t->m, t->j0, t->n, 0, N);
+}
+
+/*
+ * Strassen-Winograd
+ */
+static inline struct view subview(struct view v, int i, int j)
+{
+	v.p += (size_t)i * v.ld + j;
+	return v;
+}
+
+/*
+ * doubles of workspace needed by a sequential product of size n, and by
+ * main()'s expansion of the top depth levels of one
+ */
+#define ARENA_ROUND(x) (((x) + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN)
+
+size_t strassen_need(int n)
+{
+	if (n <= crossover) return 0;
+	if (n & 1) return strassen_need(n - 1);
+	return 15 * ARENA_ROUND((size_t)(n/2) * padded_ld(n/2)) + strassen_need(n/2);
+}
+
+size_t expand_need(int n, int depth)
+{
+	if (depth == 0 || n <= crossover) return 0;
+	if (n & 1) return expand_need(n - 1, depth);
+	return 15 * ARENA_ROUND((size_t)(n/2) * padded_ld(n/2)) + 7 * expand_need(n/2, depth - 1);
+}
+
+void arena_reserve(struct arena *ar, size_t size)
+{
+	if (ar->size >= size) return;
+	free(ar->base);
+	ar->base = (double *) memalign(PACK_ALIGN, size * sizeof(double));
+	if (ar->base == NULL) {
+		printf("cannot allocate %zu byte Strassen workspace\n", size * sizeof(double));
+		exit(1);
+	}
+	ar->size = size;
+	ar->used = 0;
+}
+
+/*
+ * take an n x n temporary, padded like the matrices, from the arena
+ */
+struct view arena_view(struct arena *ar, int n)
+{
+	struct view v;
+	size_t len = ARENA_ROUND((size_t)n * padded_ld(n));
+
+	if (ar->used + len > ar->size) {
+		printf("Strassen workspace exhausted\n");
+		exit(1);
+	}
+	v.p = ar->base + ar->used;
+	v.ld = padded_ld(n);
+	ar->used += len;
+	return v;
+}
+
+/*
+ * z = x + sign * y over n x n
+ */
+void view_add(int n, struct view x, struct view y, double sign, struct view z)
+{
+	register int i, j;
+
+	for (i = 0; i < n; i++)
+		for (j = 0; j < n; j++)
+			z.p[(size_t)i*z.ld + j] = x.p[(size_t)i*x.ld + j] + sign * y.p[(size_t)i*y.ld + j];
+}
+
+/*
+ * z += x + sign * y over n x n
+ */
+void view_acc(int n, struct view x, struct view y, double sign, struct view z)
+{
+	register int i, j;
+
+	for (i = 0; i < n; i++)
+		for (j = 0; j < n; j++)
+			z.p[(size_t)i*z.ld + j] += x.p[(size_t)i*x.ld + j] + sign * y.p[(size_t)i*y.ld + j];
+}
+
+/*
+ * c += a * b for an m x k times k x n product on views, with the thread's
+ * own sequential multiplier (the packed kernel and {i,j,k}stride blocking)
+ */
+void view_gemm(struct thread_arg *myarg, int m, int n, int k, struct view a, struct view b, struct view c)
+{
+	gemm_dgemm(myarg->seq, GEMM_ROW_MAJOR, GEMM_NO_TRANS, GEMM_NO_TRANS, m, n, k,
+	           1.0, a.p, a.ld, b.p, b.ld, 1.0, c.p, c.ld);
+	myarg->flops += 2.0 * m * n * k;
+}
+
+/*
+ * the parts of c += a * b that the even-sized (n-1) product leaves out
+ * when n is odd: the last row and column of c, and the rank-one update
+ * from the last column of a and last row of b
+ */
+void peel_fixup(int n, struct view a, struct view b, struct view c)
+{
+	register int i, j, k;
+	int m = n - 1;
+	double sum, aim;
+
+	for (i = 0; i < m; i++) {
+		aim = a.p[(size_t)i*a.ld + m];
+		for (j = 0; j < m; j++)
+			c.p[(size_t)i*c.ld + j] += aim * b.p[(size_t)m*b.ld + j];
+	}
+	for (i = 0; i < n; i++) {
+		for (j = (i < m) ? m : 0; j < n; j++) {
+			sum = 0.0;
+			for (k = 0; k < n; k++)
+				sum += a.p[(size_t)i*a.ld + k] * b.p[(size_t)k*b.ld + j];
+			c.p[(size_t)i*c.ld + j] += sum;
+		}
+	}
+}
+
+/*
+ * take the 15 h x h temporaries for one Winograd level from ar, form the
+ * operand sums S1..S4 and T1..T4, and zero the products P1..P7. On return
+ * x[q] and y[q] are the operands of product p[q].
+ */
+void winograd_operands(struct arena *ar, int h, struct view a, struct view b,
+                       struct view x[7], struct view y[7], struct view p[7])
+{
+	struct view a11 = a, a12 = subview(a, 0, h), a21 = subview(a, h, 0), a22 = subview(a, h, h);
+	struct view b11 = b, b12 = subview(b, 0, h), b21 = subview(b, h, 0), b22 = subview(b, h, h);
+	struct view s1, s2, s3, s4, t1, t2, t3, t4;
+	int q;
+
+	s1 = arena_view(ar, h); s2 = arena_view(ar, h); s3 = arena_view(ar, h); s4 = arena_view(ar, h);
+	t1 = arena_view(ar, h); t2 = arena_view(ar, h); t3 = arena_view(ar, h); t4 = arena_view(ar, h);
+	view_add(h, a21, a22, 1.0, s1);
+	view_add(h, s1, a11, -1.0, s2);
+	view_add(h, a11, a21, -1.0, s3);
+	view_add(h, a12, s2, -1.0, s4);
+	view_add(h, b12, b11, -1.0, t1);
+	view_add(h, b22, t1, -1.0, t2);
+	view_add(h, b22, b12, -1.0, t3);
+	view_add(h, t2, b21, -1.0, t4);
+
+	x[0] = a11; y[0] = b11;	/* P1 = A11 * B11 */
+	x[1] = a12; y[1] = b21;	/* P2 = A12 * B21 */
+	x[2] = s4;  y[2] = b22;	/* P3 = S4 * B22 */
+	x[3] = a22; y[3] = t4;	/* P4 = A22 * T4 */
+	x[4] = s1;  y[4] = t1;	/* P5 = S1 * T1 */
+	x[5] = s2;  y[5] = t2;	/* P6 = S2 * T2 */
+	x[6] = s3;  y[6] = t3;	/* P7 = S3 * T3 */
+	for (q = 0; q < 7; q++) {
+		p[q] = arena_view(ar, h);
+		memset(p[q].p, 0, (size_t)h * p[q].ld * sizeof(double));
+	}
+}
+
+/*
+ * c += [ P1+P2  U4+P3 ; U3-P4  U3+P5 ] where U2 = P1+P6, U3 = U2+P7 and
+ * U4 = U2+P5; U2/U4 are built in P6 and U3 in P7
+ */
+void winograd_combine(int h, struct view p[7], struct view c)
+{
+	view_add(h, p[5], p[0], 1.0, p[5]);	/* P6 <- U2 */
+	view_add(h, p[6], p[5], 1.0, p[6]);	/* P7 <- U3 */
+	view_acc(h, p[0], p[1], 1.0, c);	/* C11 += P1 + P2 */
+	view_acc(h, p[6], p[3], -1.0, subview(c, h, 0));	/* C21 += U3 - P4 */
+	view_acc(h, p[6], p[4], 1.0, subview(c, h, h));	/* C22 += U3 + P5 */
+	view_add(h, p[5], p[4], 1.0, p[5]);	/* P6 <- U4 */
+	view_acc(h, p[5], p[2], 1.0, subview(c, 0, h));	/* C12 += U4 + P3 */
+}
+
+/*
+ * c += a * b for n x n views, sequentially, with temporaries from myarg's arena
+ */
+void strassen_seq(struct thread_arg *myarg, int n, struct view a, struct view b, struct view c)
+{
+	struct view x[7], y[7], p[7];
+	size_t mark;
+	int h, q;
+
+	if (n <= crossover) {
+		view_gemm(myarg, n, n, n, a, b, c);
+		return;
+	}
+	if (n & 1) {
+		strassen_seq(myarg, n - 1, a, b, c);
+		peel_fixup(n, a, b, c);
+		return;
+	}
+	h = n / 2;
+	mark = myarg->arena.used;
+	winograd_operands(&myarg->arena, h, a, b, x, y, p);
+	for (q = 0; q < 7; q++)
+		strassen_seq(myarg, h, x[q], y[q], p[q]);
+	winograd_combine(h, p, c);
+	myarg->arena.used = mark;
+}
+
+/*
+ * expand the top depth levels of c += a * b into Leaves[] (independent
+ * products for the pool) and Steps[] (fix-ups to run, in order, once the
+ * leaves are done). Children are expanded before their parent's combine
+ * step is appended, so the steps are in a valid order.
+ */
+void strassen_expand(int n, struct view a, struct view b, struct view c, int depth)
+{
+	struct view x[7], y[7], p[7];
+	struct step *st;
+	int h, q;
+
+	if (depth == 0 || n <= crossover) {
+		Leaves[Nleaves].n = n;
+		Leaves[Nleaves].a = a;
+		Leaves[Nleaves].b = b;
+		Leaves[Nleaves].c = c;
+		Nleaves++;
+		return;
+	}
+	if (n & 1) {
+		strassen_expand(n - 1, a, b, c, depth);
+		st = &Steps[Nsteps++];
+		st->kind = STEP_PEEL;
+		st->n = n;
+		st->a = a;
+		st->b = b;
+		st->c = c;
+		return;
+	}
+	h = n / 2;
+	winograd_operands(&MainArena, h, a, b, x, y, p);
+	for (q = 0; q < 7; q++)
+		strassen_expand(h, x[q], y[q], p[q], depth - 1);
+	st = &Steps[Nsteps++];
+	st->kind = STEP_COMBINE;
+	st->n = h;
+	st->c = c;
+	for (q = 0; q < 7; q++)
+		st->p[q] = p[q];
+}
+
+/*
+ * compute leaf product t; the pool's scheduler hands the leaves out to
+ * the workers
+ */
+void strassen_leaf(void *arg, int id, long long t)
+{
+	struct thread_arg *myarg = &Args[id];
+	struct leaf *lf = &Leaves[t];
+
+	arena_reserve(&myarg->arena, strassen_need(lf->n));
+	myarg->arena.used = 0;
+	strassen_seq(myarg, lf->n, lf->a, lf->b, lf->c);
+}
+
+/*
+ * number of Strassen levels main() expands so that there are at least as
+ * many leaf products as threads
+ */
+int strassen_depth(void)
+{
+	int depth = 0, leaves = 1;
+
+	while (leaves < Nthreads) {
+		leaves *= 7;
+		depth++;
+	}
+	return depth;
+}
+
+/*
+ * C += A * B with Strassen-Winograd on the pool
+ */
+void strassen_multiply(void)
+{
+	struct view a = { A.data, A.ld }, b = { B.data, B.ld }, c = { C.data, C.ld };
+	int depth = strassen_depth(), i;
+	struct step *st;
+
+	MainArena.used = 0;
+	Nleaves = Nsteps = 0;
+	strassen_expand(N, a, b, c, depth);
+	gemm_parallel_for(Ctx, Nleaves, strassen_leaf, NULL);
+	for (i = 0; i < Nsteps; i++) {
+		st = &Steps[i];
+		if (st->kind == STEP_PEEL)
+			peel_fixup(st->n, st->a, st->b, st->c);
+		else
+			winograd_combine(st->n, st->p, st->c);
+	}
+}
+
+/*
+ * Stride auto-tuner
+ */
+
+/*
+ * the CPU model string from /proc/cpuinfo, or "unknown"
+ */
+void cpu_model(char *model, int len)
+{
+	FILE *fp;
+	char line[256], *p;
+
+	snprintf(model, len, "unknown");
+	if ((fp = fopen("/proc/cpuinfo", "r")) == NULL)
+		return;
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (strncmp(line, "model name", 10) == 0 && (p = strchr(line, ':')) != NULL) {
+			for (p++; *p == ' ' || *p == '\t'; p++)
+				;
+			p[strcspn(p, "\n")] = '\0';
+			snprintf(model, len, "%s", p);
+			break;
+		}
+	}
+	fclose(fp);
+}
+
+char *tune_db_path(void)
+{
+	char *path = getenv("MMULT_TUNE_DB");
+
+	return (path && *path) ? path : TUNE_DB;
+}
+
+/*
+ * look up strides for this N, thread count, kernel and CPU in the tuning
+ * database; returns 1 and sets {i,j,k}stride if there is an entry
+ *
+ * Each line of the database is:
+ *   N threads kernel istride jstride kstride gflops cpu-model...
+ */
+int load_tuning(void)
+{
+	FILE *fp;
+	char line[512], kern[32], model[256], mine[256];
+	int n, p, is, js, ks, off;
+	double gflops;
+
+	if ((fp = fopen(tune_db_path(), "r")) == NULL)
+		return 0;
+	cpu_model(mine, sizeof(mine));
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (sscanf(line, "%d %d %31s %d %d %d %lf %n", &n, &p, kern, &is, &js, &ks, &gflops, &off) != 7)
+			continue;
+		snprintf(model, sizeof(model), "%s", line + off);
+		model[strcspn(model, "\n")] = '\0';
+		if (n == N && p == Nthreads && strcmp(model, mine) == 0 &&
+		    strcmp(kern, KernelName) == 0) {
+			istride = is;
+			jstride = js;
+			kstride = ks;
+			fclose(fp);
+			return 1;
+		}
+	}
+	fclose(fp);
+	return 0;
+}
+
+/*
+ * replace (or add) this configuration's entry in the tuning database
+ */
+void save_tuning(double gflops)
+{
+	FILE *in, *outf;
+	char line[512], kern[32], model[256], mine[256], tmp[PATH_MAX];
+	char *path = tune_db_path();
+	const char *kname = KernelName;
+	int n, p, off;
+
+	cpu_model(mine, sizeof(mine));
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	if ((outf = fopen(tmp, "w")) == NULL) {
+		printf("Cannot open %s: %s\n", tmp, strerror(errno));
+		return;
+	}
+	if ((in = fopen(path, "r")) != NULL) {
+		while (fgets(line, sizeof(line), in) != NULL) {
+			if (sscanf(line, "%d %d %31s %*d %*d %*d %*f %n", &n, &p, kern, &off) == 3) {
+				snprintf(model, sizeof(model), "%s", line + off);
+				model[strcspn(model, "\n")] = '\0';
+				if (n == N && p == Nthreads && strcmp(kern, kname) == 0 && strcmp(model, mine) == 0)
+					continue;
+			}
+			fputs(line, outf);
+		}
+		fclose(in);
+	}
+	fprintf(outf, "%d %u %s %d %d %d %.3f %s\n", N, Nthreads, kname, istride, jstride, kstride, gflops, mine);
+	fclose(outf);
+	if (rename(tmp, path) != 0)
+		printf("Cannot rename %s to %s: %s\n", tmp, path, strerror(errno));
+}
+
+/*
+ * time the block algorithm with the given strides over the first tile rows
+ * of C; returns the best GFLOP/s of AUTOTUNE_REPEATS runs
+ */
+double tune_trial(int is, int js, int ks)
+{
+	unsigned long long tiles, tile_cols;
+	double flops, best = 0.0;
+	int r, rows;
+
+	istride = is;
+	jstride = js;
+	kstride = ks;
+	gemm_set_blocking(Ctx, istride, jstride, kstride);
+	tile_cols = (N + jstride - 1) / jstride;
+	tiles = (unsigned long long)(AUTOTUNE_TRIAL_FLOPS / (2.0 * istride * jstride * N)) + 1;
+	if (tiles < 2 * Nthreads)
+		tiles = 2 * Nthreads;
+	rows = MIN((long long)N, (long long)((tiles + tile_cols - 1) / tile_cols) * istride);
+	flops = 2.0 * rows * N * (double)N;
+	for (r = 0; r < AUTOTUNE_REPEATS; r++) {
+		initialize_time();
+		gemm_dgemm(Ctx, GEMM_ROW_MAJOR, GEMM_NO_TRANS, GEMM_NO_TRANS, rows, N, N,
+		           1.0, A.data, A.ld, B.data, B.ld, 1.0, C.data, C.ld);
+		elapsed_time();
+		if (flops / ElapsedTimeInSeconds / 1e9 > best)
+			best = flops / ElapsedTimeInSeconds / 1e9;
+	}
+	if (debug) printf("autotune: istride=%d jstride=%d kstride=%d %.3f GFLOP/s\n", is, js, ks, best);
+	return best;
+}
+
+/*
+ * clamp a candidate stride to [8, N] and round it to a multiple of 8
+ */
+int tune_clamp(double x)
+{
+	int v = ((int)(x + 4)) / 8 * 8;
+
+	if (v < 8) v = 8;
+	return MIN(v, N);
+}
+
+/*
+ * search the stride space; leaves the winner in {i,j,k}stride and saves it
+ */
+void tune_strides(void)
+{
+	static const int grid_i[] = { 32, 64, 128, 256 };
+	static const int grid_jk[] = { 64, 128, 256, 512 };
+	static const double steps[] = { 0.5, 0.75, 1.5, 2.0 };
+	int a, b, c, r, d, q, improved;
+	int best[3], cand[3];
+	double g, bestg = 0.0;
+
+	for (a = 0; a < 4; a++) {
+		for (b = 0; b < 4; b++) {
+			for (c = 0; c < 4; c++) {
+				cand[0] = MIN(grid_i[a], N);
+				cand[1] = MIN(grid_jk[b], N);
+				cand[2] = MIN(grid_jk[c], N);
+				if ((grid_i[a] > N && a > 0 && grid_i[a-1] >= N) ||
+				    (grid_jk[b] > N && b > 0 && grid_jk[b-1] >= N) ||
+				    (grid_jk[c] > N && c > 0 && grid_jk[c-1] >= N))
+					continue;	/* same clamped point as an earlier one */
+				if ((g = tune_trial(cand[0], cand[1], cand[2])) > bestg) {
+					bestg = g;
+					memcpy(best, cand, sizeof(best));
+				}
+			}
+		}
+	}
+	//
+	// local refinement: scale one stride at a time while that helps
+	//
+	for (r = 0, improved = 1; r < AUTOTUNE_ROUNDS && improved; r++) {
+		improved = 0;
+		for (d = 0; d < 3; d++) {
+			for (q = 0; q < sizeof(steps)/sizeof(steps[0]); q++) {
+				memcpy(cand, best, sizeof(cand));
+				cand[d] = tune_clamp(best[d] * steps[q]);
+				if (cand[d] == best[d]) continue;
+				if ((g = tune_trial(cand[0], cand[1], cand[2])) > bestg) {
+					bestg = g;
+					memcpy(best, cand, sizeof(best));
+					improved = 1;
+				}
+			}
+		}
+	}
+	istride = best[0];
+	jstride = best[1];
+	kstride = best[2];
+	printf("autotune: istride=%d jstride=%d kstride=%d (%.3f GFLOP/s), saved to %s\n",
+	       istride, jstride, kstride, bestg, tune_db_path());
+	save_tuning(bestg);
+}
+
+/*
+ * compare C against the classic result Cref and print the drift
+ */
+void report_error(struct matrix *Cref)
+{
+	int i, j;
+	double d, ref, maxabs = 0.0, maxrel = 0.0, num = 0.0, den = 0.0;
+
+	for (i = 0; i < N; i++) {
+		for (j = 0; j < N; j++) {
+			ref = ELEM(*Cref, i, j);
+			d = fabs(ELEM(C, i, j) - ref);
+			if (d > maxabs) maxabs = d;
+			if (ref != 0.0 && d / fabs(ref) > maxrel) maxrel = d / fabs(ref);
+			num += d * d;
+			den += ref * ref;
+		}
+	}
+	printf("error vs classic: max abs %e, max rel %e, rel frobenius %e\n",
+	       maxabs, maxrel, (den > 0.0) ? sqrt(num / den) : sqrt(num));
+}
+
+/*
+ * parallel first touch: the rows of A and C are split evenly into one band
+ * per worker, and each worker fills its own band so those pages land on
+ * its node. This is only a placement heuristic: neither gemm scheduler
+ * hands a worker the tiles of "its" band, so a tile's rows may live on
+ * another node. B is read by everyone and is dealt out in chunks of rows
+ * so that its pages are spread across all of the nodes.
+ */
+void first_touch(struct thread_arg *myarg)
+{
+	int i0 = (long long)N * myarg->id / Nthreads;
+	int I = (long long)N * (myarg->id + 1) / Nthreads;
+	int i;
+
+	fill_rows(&A, 0, i0, I);
+	fill_rows(&C, 2, i0, I);
+	for (i = myarg->id * FIRST_TOUCH_ROWS; i < N; i += Nthreads * FIRST_TOUCH_ROWS)
+		fill_rows(&B, 1, i, MIN(i + FIRST_TOUCH_ROWS, N));
+}
+
+/*
+ * print per-NUMA-node totals of the per-thread busy time, flops and
+ * kernel traffic, to show the effect of page placement. The traffic is
+ * the bytes the kernels are modelled to move, not measured bandwidth.
+ */
+void print_node_report(void)
+{
+	int i, node;
+	int nthr;
+	double busy, flops, bytes;
+	struct gemm_stats st;
+
+	for (node = 0; node < MAXNODES; node++) {
+		nthr = 0;
+		busy = flops = bytes = 0.0;
+		for (i = 0; i < Nthreads; i++) {
+			if (Args[i].node != node) continue;
+			gemm_get_stats(Ctx, i, &st);
+			nthr++;
+			busy += st.busy;
+			flops += st.flops + Args[i].flops;
+			bytes += st.bytes + Args[i].bytes;
+		}
+		if (nthr == 0) continue;
+		//
+		// rates are per thread-second, summed over the node's threads;
+		// a node whose threads got no tiles has no rate
+		//
+		printf("node %d: threads=%d busy=%f GFLOP/s=%.3f modelled-GB/s=%.3f\n", node, nthr,
+		       busy / nthr, (busy > 0.0) ? nthr * flops / busy / 1e9 : 0.0,
+		       (busy > 0.0) ? nthr * bytes / busy / 1e9 : 0.0);
+	}
+}
+
+int compare_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * print min, median, tail percentiles and max of the per-iteration times
+ */
+void print_percentiles(double *t, int n)
+{
+	int p;
+	static const double pct[] = { 50.0, 90.0, 99.0 };
+
+	qsort(t, n, sizeof(double), compare_double);
+	printf("repeats=%d min=%f", n, t[0]);
+	for (p = 0; p < sizeof(pct)/sizeof(pct[0]); p++)
+		printf(" p%.0f=%f", pct[p], t[(int)ceil(pct[p] / 100.0 * n) - 1]);
+	printf(" max=%f\n", t[n-1]);
+}
+
+void printarray(struct matrix *M)
+{
+	int i, j;
+
+	for (i = 0; i < M->rows; i++) {
+		for (j = 0; j < M->cols; j++) printf(" %0.1e", ELEM(*M, i, j));
+		putchar('\n');
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int i, mr, nr;
+	double *times;
+	int threaded;
+	struct matrix Cref;
+	struct gemm_context *probe;
+	struct gemm_stats st;
+
+	parseargs(argc, argv);
+	if (debug) {
+		printf("System page size is %d\n",getpagesize());
+	}
+	//
+	// Resolve -m (the Strassen-Winograd base case needs a packed kernel)
+	//
+	if ((probe = gemm_create(0, NULL, kernel_name ? kernel_name : (strassen ? "simd" : "dot"))) == NULL) {
+		printf("kernel %s is unknown or not supported on this CPU\n", kernel_name);
+		exit(1);
+	}
+	KernelName = gemm_kernel(probe, &mr, &nr);
+	gemm_destroy(probe);
+	if (debug && mr) printf("using %s %dx%d micro-kernel\n", KernelName, mr, nr);
+	if ((block || strassen) && !autotune && ((!istride)||(!jstride)||(!kstride))) {
+		if (!istride && !jstride && !kstride && block && load_tuning())
+			printf("note: using tuned block sizes from %s: istride=%d jstride=%d kstride=%d\n",
+			       tune_db_path(), istride, jstride, kstride);
+		else
+			default_strides();
+	}
+	if (profile)
+		perf_open(&MainPerf);
+	phase_begin(PHASE_INIT);
+	threaded = block || recursive || strassen;
+	if (threaded) {
+		//
+		// The pool is started once; every repeat is just a submit and a
+		// barrier on the already running workers. With -a the workers are
+		// pinned first and then fill the matrices themselves.
+		//
+		pool_init(Nthreads, affinity, KernelName);
+		if (profile)
+			pool_run(perf_attach);
+	}
+	if (load_prefix) {
+		load_matrix(&A, "a");
+		load_matrix(&B, "b");
+		load_matrix(&C, "c");
+	}
+	else if (threaded && affinity) {
+		allocate();
+		pool_run(first_touch);
+	}
+	else {
+		initialize();
+	}
+	phase_end(PHASE_INIT);
+	phase_begin(PHASE_OUTPUT);
+	if (save_prefix) {
+		save_matrix(&A, "a");
+		save_matrix(&B, "b");
+		save_matrix(&C, "c");
+	}
+	if (out) {
+		printf("A =\n");
+		printarray(&A);
+		printf("B =\n");
+		printarray(&B);
+		printf("C =\n");
+		printarray(&C);
+	}
+	phase_end(PHASE_OUTPUT);
+	times = (double *)malloc(repeats * sizeof(double));
+	if (simple) {
+		phase_begin(PHASE_MULTIPLY);
+		for (i = 0; i < repeats; i++) {
+			initialize_time();
+			simple_sequential();
+			elapsed_time();
+			times[i] = ElapsedTimeInSeconds;
+		}
+		phase_end(PHASE_MULTIPLY);
+	}
+	else if (threaded) {
+		if (autotune) {
+			//
+			// the trials accumulate into C, so refill (or map afresh)
+			// it afterwards
+			//
+			phase_begin(PHASE_TUNE);
+			tune_strides();
+			if (load_prefix) {
+				munmap(C.map, C.maplen);
+				load_matrix(&C, "c");
+			}
+			else {
+				fill_rows(&C, 2, 0, N);
+			}
+			phase_end(PHASE_TUNE);
+		}
+		gemm_set_blocking(Ctx, istride, jstride, kstride);
+		if (recursive || strassen)
+			pool_run(seq_attach);
+		if (recursive) {
+			Tasks = (struct task *)malloc(TASKS_PER_THREAD * Nthreads * sizeof(struct task));
+			make_tasks(0, N, 0, N, TASKS_PER_THREAD * Nthreads);
+			if (debug) printf("recursive: %d tasks, base case %d\n", Ntasks, RECURSIVE_BASE);
+		}
+		else if (strassen) {
+			//
+			// Leaves, steps and main()'s share of the workspace are sized
+			// for the expansion up front
+			//
+			int depth = strassen_depth(), leaves = 1;
+			for (i = 0; i < depth; i++) leaves *= 7;
+			Leaves = (struct leaf *)malloc(leaves * sizeof(struct leaf));
+			Steps = (struct step *)malloc(2 * leaves * sizeof(struct step));
+			arena_reserve(&MainArena, expand_need(N, depth));
+			if (debug) printf("strassen: crossover %d, %d parallel levels, %zu MB workspace\n",
+			                  crossover, depth, MainArena.size * sizeof(double) >> 20);
+		}
+		if (errcheck) {
+			//
+			// keep a copy of the starting C for the classic reference
+			//
+			matrix_alloc(&Cref, N, N);
+			for (i = 0; i < N; i++)
+				memcpy(ROW(Cref, i), ROW(C, i), N*sizeof(double));
+		}
+
+		//
+		// per-thread statistics cover the timed multiplies only
+		//
+		gemm_reset_stats(Ctx);
+		for (i = 0; i < Nthreads; i++)
+			Args[i].flops = Args[i].bytes = 0.0;
+		phase_begin(PHASE_MULTIPLY);
+		for (i = 0; i < repeats; i++) {
+			initialize_time();
+			if (strassen)
+				strassen_multiply();
+			else if (recursive)
+				gemm_parallel_for(Ctx, Ntasks, recursive_task, NULL);
+			else
+				block_multiply();
+			elapsed_time();
+			times[i] = ElapsedTimeInSeconds;
+		}
+		phase_end(PHASE_MULTIPLY);
+		for (i = 0; debug && steal && i < Nthreads; i++) {
+			gemm_get_stats(Ctx, i, &st);
+			printf("thread %d: %u steals\n", i, st.steals);
+		}
+	}
+	if (timing) {
+		if (repeats == 1)
+			printf("%f\n",times[0]);
+		else
+			print_percentiles(times, repeats);
+		if (threaded && affinity)
+			print_node_report();
+	}
+	phase_begin(PHASE_OUTPUT);
+	if (out) {
+		printf("C =\n");
+		printarray(&C);
+	}
+	if (save_prefix)
+		save_matrix(&C, "result");
+	phase_end(PHASE_OUTPUT);
+	if (profile)
+		print_profile();
+	if (errcheck) {
+		//
+		// run the classic block algorithm on the copy, as many times
+		// as the timed loop ran, and compare
+		//
+		for (i = 0; i < repeats; i++)
+			gemm_dgemm(Ctx, GEMM_ROW_MAJOR, GEMM_NO_TRANS, GEMM_NO_TRANS, N, N, N,
+			           1.0, A.data, A.ld, B.data, B.ld, 1.0, Cref.data, Cref.ld);
+		report_error(&Cref);
 	}
+	if (threaded)
+		pool_shutdown();
 	return(0);
 }
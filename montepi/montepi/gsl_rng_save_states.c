@@ -4,6 +4,16 @@
 //   Default state save file is taus_rng_%llu_states_with_stride_%llu.dat
 //   which, in this example, is taus_rng_16_states_with_stride_20000000000.dat
 //
+// jump-ahead usage: ./gsl_rng_save_states -J -i 20000000000 -s 1024 -p 8
+//   Computes every state directly by jumping ahead instead of stepping the
+//   generator, in parallel, and writes a versioned file (see statefile.h)
+//   that montepi validates before use
+//
+// The two modes lay the states out differently for the same -i/-s:
+//   without -J, states 0..s-1 sit 0, i, 2i, ... draws in, and one more
+//   state follows, taken one draw past s*i (s+1 states in all);
+//   with -J, exactly the s states 0, i, ..., (s-1)*i are written.
+//
 // Brad Noble - Sat Mar  4 07:29:00 CST 2017
 //
 
@@ -13,25 +23,55 @@
 #include <unistd.h>
 #include <errno.h>
 #include <math.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/time.h>
 #include <gsl/gsl_rng.h>
+#include "taus.h"
+#include "statefile.h"
 
 //
 // Program usage message and getopt(3) options
 //
-static char *usage = "[-f outfile] [-i interval] [-s states to save]\n\
+static char *usage = "[-f outfile] [-i interval] [-s states to save] [-J [-p threads] [-e seed]]\n\
                      -f <arg>, filename to save output\n\
                      -i <arg>, output interval for seed values\n\
                      -s <arg>, state values to save\n\
+                     -J, jump ahead to each state and write a versioned file\n\
+                         of exactly <states> states (without -J one extra\n\
+                         state, one draw past states*interval, is appended)\n\
+                     -p <arg>, threads computing and writing states with -J\n\
+                     -e <arg>, gsl_rng_set() seed of the first state with -J\n\
+                     -t, list the available generators\n\
                      -h, this help message";
-static char *options = "f:i:s:th";
+static char *options = "e:f:i:Jp:s:th";
 
 //
 // Globals for getopt() command line processing
 //
-int Fflag = 0, Iflag = 0, Sflag = 0, Tflag = 0, Hflag = 0, Errflag = 0;
+int Eflag = 0, Fflag = 0, Iflag = 0, Jflag = 0, Sflag = 0, Tflag = 0, Hflag = 0, Errflag = 0;
 char Outfile[256];
 unsigned long long Interval = 0;
 unsigned long long StatesToSave = 0;
+unsigned long Seed = 0;
+int Nthreads = 1;
+
+//
+// -J: state k is the first state jumped k*Interval draws ahead.
+// Jumps[b] covers 2^b intervals, so any k takes one jump per set bit.
+//
+TausState BaseState;
+struct taus_jump Jumps[64];
+TausState *States;
+int Outfd;
+
+struct thread_arg
+{
+	unsigned long long first;
+	unsigned long long count;
+	int failed;
+	int err;	// the worker's errno when failed
+};
 
 //
 // Use getopt(3) to process command line arguments
@@ -47,10 +87,25 @@ void ProcessCommandLine(int argc, char *argv[])
 	{
 		switch (ch)
 		{
+		case 'e':
+			Seed = strtoul(optarg, NULL, 10);
+			Eflag++;
+			break;
 		case 'f':
 			strncpy(Outfile, optarg, 255);
 			Fflag++;
 			break;
+		case 'J':
+			Jflag++;
+			break;
+		case 'p':
+			Nthreads = atoi(optarg);
+			if (Nthreads < 1)
+			{
+				printf("invalid threads = %d\n", Nthreads);
+				Errflag++;
+			}
+			break;
 		case 'i':
 			Interval = strtoull(optarg, NULL, 10);
 			if (Interval < 1)
@@ -88,6 +143,120 @@ void ProcessCommandLine(int argc, char *argv[])
 	}
 }
 
+//
+// Compute states [first, first+count) and write them at their place in the
+// file; each thread's block is independent of every other
+//
+void *SaveStates(void *thrarg)
+{
+	struct thread_arg *myarg = (struct thread_arg *)thrarg;
+	unsigned int s1 = BaseState.s1, s2 = BaseState.s2, s3 = BaseState.s3;
+	unsigned long long k, n;
+	size_t bytes, done;
+	ssize_t n_written;
+	off_t offset;
+	int b;
+
+	for (b = 0, k = myarg->first; k; b++, k >>= 1)
+		if (k & 1)
+			TausJumpWords(&Jumps[b], &s1, &s2, &s3);
+	for (n = 0; n < myarg->count; n++)
+	{
+		if (n > 0)
+			TausJumpWords(&Jumps[0], &s1, &s2, &s3);
+		States[myarg->first + n].s1 = s1;
+		States[myarg->first + n].s2 = s2;
+		States[myarg->first + n].s3 = s3;
+	}
+	bytes = myarg->count * sizeof(TausState);
+	offset = sizeof(struct statefile_header) + myarg->first * sizeof(TausState);
+	// a short write is retried from where it stopped
+	done = 0;
+	while (done < bytes)
+	{
+		n_written = pwrite(Outfd, (char *)(States + myarg->first) + done, bytes - done, offset + done);
+		if (n_written < 0 && errno == EINTR)
+			continue;
+		if (n_written <= 0)
+		{
+			myarg->failed = 1;
+			myarg->err = (n_written < 0) ? errno : EIO;
+			break;
+		}
+		done += n_written;
+	}
+	return NULL;
+}
+
+//
+// -J mode: jump ahead to every state in parallel, then add the header
+//
+void JumpSaveStates(void)
+{
+	struct statefile_header hdr;
+	struct thread_arg *thrarg;
+	pthread_t *threads;
+	struct timeval t0, t1;
+	gsl_rng *rng;
+	unsigned long long per;
+	int i;
+
+	gettimeofday(&t0, NULL);
+	rng = gsl_rng_alloc(gsl_rng_taus);
+	if (gsl_rng_size(rng) != sizeof(TausState))
+	{
+		printf("unexpected taus state size %u\n", (unsigned int)gsl_rng_size(rng));
+		exit(3);
+	}
+	if (Eflag)
+		gsl_rng_set(rng, Seed);
+	memcpy(&BaseState, gsl_rng_state(rng), sizeof(BaseState));
+	TausJumpInit(&Jumps[0], Interval);
+	for (i = 1; i < 64; i++)
+		TausJumpCompose(&Jumps[i], &Jumps[i-1], &Jumps[i-1]);
+
+	if ((Outfd = open(Outfile, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+	{
+		printf("Cannot open %s: %s\n", Outfile, strerror(errno));
+		exit(2);
+	}
+	States = malloc(StatesToSave * sizeof(TausState));
+	threads = malloc(Nthreads * sizeof(pthread_t));
+	thrarg = calloc(Nthreads, sizeof(struct thread_arg));
+	if (States == NULL || threads == NULL || thrarg == NULL)
+	{
+		printf("Cannot allocate %llu states for %d threads\n", StatesToSave, Nthreads);
+		exit(5);
+	}
+	per = StatesToSave / Nthreads;
+	for (i = 0; i < Nthreads; i++)
+	{
+		thrarg[i].first = i * per;
+		thrarg[i].count = (i == Nthreads - 1) ? StatesToSave - i * per : per;
+		pthread_create(&threads[i], NULL, SaveStates, &thrarg[i]);
+	}
+	for (i = 0; i < Nthreads; i++)
+	{
+		pthread_join(threads[i], NULL);
+		if (thrarg[i].failed)
+		{
+			printf("writing %s failed: %s\n", Outfile, strerror(thrarg[i].err));
+			exit(4);
+		}
+	}
+
+	StateHeaderInit(&hdr, gsl_rng_name(rng), sizeof(TausState), Interval, StatesToSave, States);
+	if (pwrite(Outfd, &hdr, sizeof(hdr), 0) != sizeof(hdr) || close(Outfd) != 0)
+	{
+		printf("writing %s failed: %s\n", Outfile, strerror(errno));
+		exit(4);
+	}
+	gettimeofday(&t1, NULL);
+	printf("%llu %s states with stride %llu written to %s in %ld microseconds\n", StatesToSave, gsl_rng_name(rng),
+	       Interval, Outfile, (t1.tv_sec - t0.tv_sec) * 1000000L + (t1.tv_usec - t0.tv_usec));
+	gsl_rng_free(rng);
+}
+
 //
 // Start the show
 //
@@ -120,6 +289,11 @@ int main(int argc, char *argv[])
 	{
 		sprintf(Outfile, "taus_rng_%llu_states_with_stride_%llu.dat", StatesToSave, Interval);
 	}
+	if (Jflag)
+	{
+		JumpSaveStates();
+		exit(0);
+	}
 	if ((fp = fopen(Outfile, "w")) == NULL)
 	{
 		printf("Cannot open %s: %s\n", Outfile, strerror(errno));
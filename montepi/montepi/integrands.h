@@ -0,0 +1,303 @@
+//
+// integrands.h
+//
+// Built-in integrands for montepi -I.  Each entry of INTEGRANDS() is
+//
+//	X(name, dimensions, lo, hi, exact value, f(x))
+//
+// and integrates f over the box [lo,hi]^dimensions.  The expression sees the
+// sample point as x[0] .. x[dimensions-1].  INTEGRAND_SAMPLERS() turns every
+// entry into its own sampling loops, one per sampler, so the dimension is a
+// constant and f is inlined: the hot loops have no calls and no
+// per-integrand branches.  At most SOBOL_MAXDIM dimensions.
+//
+// To add an integrand, add a line here; nothing else changes.
+//
+
+#ifndef INTEGRANDS_H
+#define INTEGRANDS_H
+
+#include <math.h>
+#include <gsl/gsl_rng.h>
+#include "taus.h"
+
+//
+// Exact values
+//
+#define BALL5_VOLUME (8.0 * M_PI * M_PI / 15.0)
+#define GAUSS3_VALUE pow(0.5 * sqrt(M_PI) * erf(1.0), 3)
+#define COS4_VALUE (pow(sin(1.0), 4) - 6.0 * pow(sin(1.0) * (1.0 - cos(1.0)), 2) + pow(1.0 - cos(1.0), 4))
+
+#define INTEGRANDS(X) \
+	X(pi, 2, 0.0, 1.0, M_PI, 4.0 * (x[0]*x[0] + x[1]*x[1] <= 1.0)) \
+	X(ball5, 5, -1.0, 1.0, BALL5_VOLUME, (x[0]*x[0] + x[1]*x[1] + x[2]*x[2] + x[3]*x[3] + x[4]*x[4] <= 1.0)) \
+	X(gauss3, 3, 0.0, 1.0, GAUSS3_VALUE, exp(-(x[0]*x[0] + x[1]*x[1] + x[2]*x[2]))) \
+	X(cos4, 4, 0.0, 1.0, COS4_VALUE, cos(x[0] + x[1] + x[2] + x[3]))
+
+//
+// Samplers.  Every sampler turns n throws, starting at global throw number
+// "first", into sums of f and f^2 without the volume.  Throws come in
+// indivisible groups (SamplerGroup()) whose averages are independent, and
+// sumsq holds group * (group average)^2 per group, so in every case
+//
+//	var = sumsq/n - (sum/n)^2,   standard error = volume * sqrt(var * group / n)
+//
+// Sobol points are not independent at all; its error comes from the
+// SOBOL_REPLICATES independently shifted copies summed into rsum[].
+//
+enum sampler { PLAIN, ANTITHETIC, STRATIFIED, SOBOL, NSAMPLERS };
+static const char *SamplerNames[NSAMPLERS] = { "plain", "antithetic", "stratified", "sobol" };
+
+#define STRATA 4096		// about this many cells in a stratified sweep
+#define SOBOL_MAXDIM 8
+#define SOBOL_REPLICATES 8
+
+//
+// Cells per side of the stratified grid, giving m^dim <= STRATA cells
+//
+static inline int StrataPerSide(int dim)
+{
+	int m = (int)floor(pow(STRATA, 1.0 / dim) + 1e-9);
+
+	return (m < 1) ? 1 : m;
+}
+
+static inline unsigned long long SamplerGroup(enum sampler sampler, int dim)
+{
+	switch (sampler)
+	{
+	case ANTITHETIC:
+		return 2;
+	case STRATIFIED:
+		return (unsigned long long)pow(StrataPerSide(dim), dim);
+	case SOBOL:
+		return SOBOL_REPLICATES;
+	default:
+		return 1;
+	}
+}
+
+//
+// Sobol direction numbers (Joe and Kuo, new-joe-kuo-6.21201) and the random
+// digital shift of every replicate, set up by SobolInit()
+//
+static unsigned int SobolV[SOBOL_MAXDIM][32];
+static unsigned int SobolShift[SOBOL_REPLICATES][SOBOL_MAXDIM];
+
+static inline void SobolInit(gsl_rng *rng)
+{
+	static const struct { int s, a; unsigned int m[5]; } jk[SOBOL_MAXDIM - 1] = {
+		{ 1, 0, { 1 } },
+		{ 2, 1, { 1, 3 } },
+		{ 3, 1, { 1, 3, 1 } },
+		{ 3, 2, { 1, 1, 1 } },
+		{ 4, 1, { 1, 1, 3, 3 } },
+		{ 4, 4, { 1, 3, 5, 13 } },
+		{ 5, 2, { 1, 1, 5, 5, 17 } },
+	};
+	int d, i, k, s, a;
+
+	for (i = 0; i < 32; i++)
+		SobolV[0][i] = 1U << (31 - i);
+	for (d = 1; d < SOBOL_MAXDIM; d++)
+	{
+		s = jk[d-1].s;
+		a = jk[d-1].a;
+		for (i = 0; i < 32; i++)
+		{
+			if (i < s)
+				SobolV[d][i] = jk[d-1].m[i] << (31 - i);
+			else
+			{
+				SobolV[d][i] = SobolV[d][i-s] ^ (SobolV[d][i-s] >> s);
+				for (k = 1; k < s; k++)
+					if ((a >> (s - 1 - k)) & 1)
+						SobolV[d][i] ^= SobolV[d][i-k];
+			}
+		}
+	}
+	for (i = 0; i < SOBOL_REPLICATES; i++)
+		for (d = 0; d < SOBOL_MAXDIM; d++)
+			SobolShift[i][d] = gsl_rng_get(rng);
+}
+
+#define TAUS_LOAD(rng) \
+	memcpy(&st, gsl_rng_state(rng), sizeof(st)); \
+	s1 = st.s1; \
+	s2 = st.s2; \
+	s3 = st.s3
+#define TAUS_SAVE(rng) \
+	st.s1 = s1; \
+	st.s2 = s2; \
+	st.s3 = s3; \
+	memcpy(gsl_rng_state(rng), &st, sizeof(st))
+
+//
+// One taus draw scaled exactly as gsl_rng_uniform() scales it, so the
+// stream consumed is the gsl_rng's own
+//
+#define UNIFORM() (TAUS_STEP(s1, s2, s3) / 4294967296.0)
+
+#define SAMPLER_ARGS gsl_rng *rng, unsigned long long first, unsigned long long n, double *sum, double *sumsq, double *rsum
+
+#define INTEGRAND_SAMPLERS(name, dim, lo, hi, value, expr) \
+static inline double F_##name(const double *x) \
+{ \
+	return (expr); \
+} \
+\
+/* independent uniform points */ \
+static void Plain_##name(SAMPLER_ARGS) \
+{ \
+	TausState st; \
+	unsigned int s1, s2, s3; \
+	unsigned long long i; \
+	double x[dim], f, s = 0.0, ss = 0.0; \
+	int d; \
+\
+	TAUS_LOAD(rng); \
+	for (i = 0; i < n; i++) \
+	{ \
+		for (d = 0; d < dim; d++) \
+			x[d] = (lo) + ((hi) - (lo)) * UNIFORM(); \
+		f = F_##name(x); \
+		s += f; \
+		ss += f * f; \
+	} \
+	TAUS_SAVE(rng); \
+	*sum = s; \
+	*sumsq = ss; \
+} \
+\
+/* each point together with its reflection through the centre of the box */ \
+static void Antithetic_##name(SAMPLER_ARGS) \
+{ \
+	TausState st; \
+	unsigned int s1, s2, s3; \
+	unsigned long long i; \
+	double x[dim], y[dim], a, s = 0.0, ss = 0.0; \
+	int d; \
+\
+	TAUS_LOAD(rng); \
+	for (i = 0; i < n; i += 2) \
+	{ \
+		for (d = 0; d < dim; d++) \
+		{ \
+			x[d] = (lo) + ((hi) - (lo)) * UNIFORM(); \
+			y[d] = (lo) + (hi) - x[d]; \
+		} \
+		a = 0.5 * (F_##name(x) + F_##name(y)); \
+		s += 2.0 * a; \
+		ss += 2.0 * a * a; \
+	} \
+	TAUS_SAVE(rng); \
+	*sum = s; \
+	*sumsq = ss; \
+} \
+\
+/* one uniform point per cell of an m^dim grid, sweeping the cells in order; \
+   throw j lands in cell j mod m^dim, so threads and chunks partition the \
+   sweeps between them */ \
+static void Stratified_##name(SAMPLER_ARGS) \
+{ \
+	TausState st; \
+	unsigned int s1, s2, s3; \
+	unsigned long long i, cell, cells; \
+	double x[dim], width, acc = 0.0, s = 0.0, ss = 0.0; \
+	int d, m = StrataPerSide(dim); \
+\
+	cells = SamplerGroup(STRATIFIED, dim); \
+	width = ((hi) - (lo)) / m; \
+	TAUS_LOAD(rng); \
+	for (i = 0; i < n; i++) \
+	{ \
+		cell = (first + i) % cells; \
+		for (d = 0; d < dim; d++, cell /= m) \
+			x[d] = (lo) + width * ((cell % m) + UNIFORM()); \
+		acc += F_##name(x); \
+		if ((first + i + 1) % cells == 0) \
+		{ \
+			s += acc; \
+			ss += acc * acc / cells; \
+			acc = 0.0; \
+		} \
+	} \
+	TAUS_SAVE(rng); \
+	*sum = s; \
+	*sumsq = ss; \
+} \
+\
+/* Sobol points in Gray-code order; throw j is point j / R of replicate \
+   j mod R.  Starting mid-sequence costs one XOR per bit of the index. */ \
+static void Sobol_##name(SAMPLER_ARGS) \
+{ \
+	unsigned int p, g, X[dim]; \
+	unsigned long long i; \
+	double x[dim], f, s = 0.0; \
+	int d, b, r; \
+\
+	p = first / SOBOL_REPLICATES; \
+	g = p ^ (p >> 1); \
+	for (d = 0; d < dim; d++) \
+		for (X[d] = 0, b = 0; b < 32; b++) \
+			if ((g >> b) & 1) \
+				X[d] ^= SobolV[d][b]; \
+	for (i = 0; i < n; i += SOBOL_REPLICATES) \
+	{ \
+		for (r = 0; r < SOBOL_REPLICATES; r++) \
+		{ \
+			for (d = 0; d < dim; d++) \
+				x[d] = (lo) + ((hi) - (lo)) * (((X[d] ^ SobolShift[r][d]) + 0.5) / 4294967296.0); \
+			f = F_##name(x); \
+			rsum[r] += f; \
+			s += f; \
+		} \
+		p++; \
+		b = __builtin_ctz(p); \
+		for (d = 0; d < dim; d++) \
+			X[d] ^= SobolV[d][b]; \
+	} \
+	*sum = s; \
+	*sumsq = 0.0; \
+}
+
+INTEGRANDS(INTEGRAND_SAMPLERS)
+
+//
+// Table of the built-ins for lookup by name
+//
+struct integrand
+{
+	const char *name;
+	int dim;
+	double lo, hi;
+	double exact;
+	void (*sample[NSAMPLERS])(SAMPLER_ARGS);
+};
+
+#define INTEGRAND_ENTRY(name, dim, lo, hi, exact, expr) \
+	{ #name, dim, lo, hi, 0.0, { Plain_##name, Antithetic_##name, Stratified_##name, Sobol_##name } },
+static struct integrand Integrands[] = { INTEGRANDS(INTEGRAND_ENTRY) };
+
+//
+// The exact values are not all constant expressions, so fill them in here
+//
+#define INTEGRAND_EXACT(name, dim, lo, hi, value, expr) Integrands[i++].exact = (value);
+static inline void IntegrandsInit(void)
+{
+	int i = 0;
+
+	INTEGRANDS(INTEGRAND_EXACT)
+}
+
+static inline struct integrand *FindIntegrand(const char *name)
+{
+	int i;
+
+	for (i = 0; i < sizeof(Integrands) / sizeof(Integrands[0]); i++)
+		if (strcmp(Integrands[i].name, name) == 0)
+			return &Integrands[i];
+	return NULL;
+}
+
+#endif
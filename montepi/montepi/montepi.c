@@ -23,7 +23,16 @@
 #include <sys/time.h>
 #include <time.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <gsl/gsl_rng.h>
+#include <gsl/gsl_cdf.h>
+#include "taus.h"
+#include "integrands.h"
+#include "statefile.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD
+#endif
 
 //
 // Defined compilation switches
@@ -36,16 +45,48 @@
 #define	DEFAULT_NUMBER_OF_THREADS 1
 #define	DEFAULT_THROWS 100000000
 #define MAXTHREADS 64
+#define DEFAULT_STRIDE 20000000000ULL	// same spacing as the shipped .dat files
+#define LANES 8		// interleaved taus streams per thread for -g simd
+#define CACHE_LINE 64
+#define DEFAULT_CHUNK 1048576		// -c default when -E needs chunks
+#define MAX_TARGET_THROWS 1000000000000000ULL	// -E budget when no -t is given
+#define POLL_MS 2			// how often main() checks the -E target
+#define ORDER_WINDOW 1024		// -R chunks that may finish ahead of the oldest unfolded one
 
 //
-// Structure for passing arguments to threads
+// Structure for passing arguments to threads.  Each one gets its own
+// cache line so results written back by one thread never invalidate
+// another thread's line.
 //
 struct thread_arg
 {
 	int id;
 	unsigned long long throws;
+	unsigned long long first;	// global number of our first throw, without -c
 	unsigned long long hits;
-	gsl_rng *rng;
+	double sum, sumsq;	// of the samples of f; for darts both are the hits
+	double rsum[SOBOL_REPLICATES];	// per-replicate sums for -v sobol
+	unsigned long long chunks;
+	//
+	// Running totals published after every chunk for -E.  seq is odd
+	// while they are being updated so main() can read a consistent set
+	// without a lock.
+	//
+	atomic_uint seq;
+	atomic_ullong pubthrows;
+	_Atomic double pubsum;
+	_Atomic double pubsumsq;
+} __attribute__((aligned(CACHE_LINE)));
+
+//
+// LANES independent taus generators stored component-wise so one
+// AVX2 register holds the same component of every lane
+//
+struct taus_lanes
+{
+	unsigned int s1[LANES] __attribute__((aligned(32)));
+	unsigned int s2[LANES] __attribute__((aligned(32)));
+	unsigned int s3[LANES] __attribute__((aligned(32)));
 };
 
 //
@@ -56,34 +97,144 @@ struct
 	pthread_mutex_t lock;
 	pthread_cond_t done;
 	int count;
+	//
+	// -c chunked scheduling: threads claim chunk numbers from "next"
+	// until all "nchunks" are taken; it sits on its own cache line
+	//
+	atomic_ullong next __attribute__((aligned(CACHE_LINE)));
+	unsigned long long nchunks;
+	atomic_int stop;	// set by main() once the -E target is met
+	//
+	// -B worker pool: a new generation starts a run, shutdown ends the pool
+	//
+	pthread_cond_t go;
+	unsigned generation;
+	int shutdown;
 } Work;
 
+//
+// -R: every chunk's result goes into slot k % ORDER_WINDOW and is folded
+// into the totals strictly in chunk order, and with -E the target is
+// checked after every fold.  The sums, and the chunk a run stops after,
+// then depend only on the chunks, never on which thread ran which.
+//
+struct chunk_result
+{
+	unsigned long long hits, throws;
+	double sum, sumsq;
+	double rsum[SOBOL_REPLICATES];
+	int ready;
+};
+
+struct
+{
+	pthread_mutex_t lock;
+	pthread_cond_t room;	// signalled whenever "folded" advances
+	unsigned long long folded;	// chunks folded into the totals so far
+	unsigned long long limit;	// chunks from here on are discarded
+	unsigned long long hits, throws;
+	double sum, sumsq;
+	double rsum[SOBOL_REPLICATES];
+	struct chunk_result slot[ORDER_WINDOW];
+} Order;
+
 //
 // Program usage message and getopt(3) options
 //
-static char *usage = "[-d] [-f Outfilefile] [-h] [-s] [-t throws] [-i iterations]\n \
+static char *usage = "[-B jobfile [-O csv|json]] [-c chunk] [-C confidence] [-d] [-e seed] [-E target] [-f Outfilefile] [-g engine] [-h] [-I integrand] [-j stride] [-v sampler] [-r statefile] [-R] [-s] [-t throws] [-i iterations]\n \
+                 -B <arg>, run the jobs in file arg (- for stdin) on one thread pool, one CSV line per run;\n \
+                           a job line is \"throws threads[-threads] [repeats]\"\n \
+                 -c <arg>, hand out throws in chunks of arg (a multiple of 8) to whichever thread is free\n \
+                 -C <arg>, with -E, the target is the half-width of this two-sided confidence interval (e.g. 0.95)\n \
                  -d, turn on debugging messages\n \
+                 -e <arg>, gsl_rng_set() seed of the first stream when no -r file is given\n \
+                 -E <arg>, stop once the standard error of the estimate is at most arg; -t becomes the budget\n \
                  -f <arg>, where arg is a file name for Outfile\n \
+                 -g <arg>, dart engine: gsl (default) or simd\n \
                  -h, print this help message and exit\n \
+                 -O <arg>, -B output format: csv (default) or json lines\n \
+                 -I <arg>, integrate a built-in integrand (pi, ball5, gauss3, cos4) instead of throwing darts\n \
+                 -j <arg>, RNG draws between thread streams (default: the -r file's stride, else 20000000000)\n \
                  -p <arg>, number of pthreads\n \
-                 -r <arg>, file containing GSL RNG states\n \
+                 -r <arg>, file containing GSL RNG states; streams past its end are jumped ahead\n \
+                 -R, reproducible: results, including where -E stops, are bit-identical for any -p (given -c)\n \
                  -t <arg>, number of throws per iteration\n \
+                 -v <arg>, sampler: plain, stratified, antithetic or sobol; implies -I pi and reports efficiency\n \
                  -s, print wall-clock timing summary";
-static char *options = "df:ht:p:r:s";
+static char *options = "B:c:C:de:E:f:g:hI:j:O:t:p:r:Rsv:";
 
 //
 // C pre-processor Macros
 //
 #define SQUARE(a) ((a)*(a))
 
+//
+// x = u/2^32 and y = v/2^32 land in the quarter circle iff u*u + v*v <= 2^64;
+// doing that test on the unscaled values in double rounds exactly like
+// gsl_rng_uniform() followed by SQUARE(x) + SQUARE(y) <= 1.0
+//
+#define TWO64 18446744073709551616.0
+
 //
 // Globals for getopt() command line processing
 //
-int Dflag = 0, Fflag = 0, Hflag = 0, Rflag = 0, Tflag = 0, Sflag = 0, Errflag = 0;
+int Bflag = 0, Dflag = 0, Eflag = 0, Fflag = 0, Hflag = 0, Jflag = 0, Rflag = 0, Tflag = 0, Sflag = 0, Errflag = 0;
 char Outfile[256];
 char RNGStateFile[256];
+char JobFile[256];
+int JsonOutput = 0;
 unsigned long long TotalThrows = DEFAULT_THROWS;
 unsigned Nthreads = DEFAULT_NUMBER_OF_THREADS;
+int SimdEngine = 0;
+unsigned long Seed = 0;
+unsigned long long Stride = DEFAULT_STRIDE;
+unsigned long long Chunk = 0;
+double Target = 0.0;
+double Confidence = 0.0;
+double Z = 1.0;		// standard errors in the -E/-C half-width
+int Reproducible = 0;
+
+//
+// What each sample computes: darts by default, or -I's integrand.  A
+// sample consumes Draws RNG draws, and the estimate is Scale times the
+// mean of f.
+//
+struct integrand *Integrand = NULL;
+int Draws = 2;
+double Scale = 4.0;
+double Exact = M_PI;
+
+//
+// -v variance reduction; throws are split between threads and chunks only
+// in whole groups of Group (see SamplerGroup())
+//
+int Vflag = 0;
+enum sampler Sampler = PLAIN;
+unsigned long long Group = 1;
+
+//
+// Jump between the lanes of one thread's -g simd engine
+//
+struct taus_jump LaneJump;
+
+//
+// Thread streams: stream i < NStates is state i of the mapped -r file, any
+// later one is StreamBase (stream BaseIndex, the last one available)
+// jumped ahead; StreamJump[b] skips 2^b streams of Stride draws
+//
+const char *StateMap = NULL;
+long long NStates = 0;
+TausState StreamBase;
+long long BaseIndex = 0;
+struct taus_jump StreamJump[64];
+
+//
+// Chunk k owns draws [D*Chunk*k, D*Chunk*(k+1)) of the first stream, whose
+// start is ChunkBase.  ChunkJump[b] skips 2^b chunks, so any chunk is
+// reached with one jump per set bit of k, whichever thread claims it.
+//
+TausState ChunkBase;
+struct taus_jump ChunkJump[64];
 
 //
 // Use getopt(3) to process command line arguments
@@ -99,12 +250,80 @@ void ProcessCommandLine(int argc, char *argv[])
 	{
 		switch (ch)
 		{
+		case 'B':
+			strncpy(JobFile, optarg, 255);
+			Bflag++;
+			break;
+		case 'c':
+			Chunk = strtoull(optarg, NULL, 10);
+			if (Chunk < 1 || Chunk % LANES != 0)
+			{
+				printf("invalid chunk = %llu\n", Chunk);
+				Errflag++;
+			}
+			break;
+		case 'C':
+			Confidence = atof(optarg);
+			if (Confidence <= 0.0 || Confidence >= 1.0)
+			{
+				printf("invalid confidence = %s\n", optarg);
+				Errflag++;
+			}
+			break;
 		case 'd':
 			Dflag++;
 			break;
+		case 'E':
+			Target = atof(optarg);
+			if (Target <= 0.0)
+			{
+				printf("invalid target = %s\n", optarg);
+				Errflag++;
+			}
+			break;
+		case 'e':
+			Seed = strtoul(optarg, NULL, 10);
+			Eflag++;
+			break;
+		case 'g':
+			if (strcmp(optarg, "simd") == 0)
+				SimdEngine = 1;
+			else if (strcmp(optarg, "gsl") == 0)
+				SimdEngine = 0;
+			else
+			{
+				printf("invalid engine = %s\n", optarg);
+				Errflag++;
+			}
+			break;
 		case 'h':
 			Hflag++;
 			break;
+		case 'I':
+			if ((Integrand = FindIntegrand(optarg)) == NULL)
+			{
+				printf("invalid integrand = %s\n", optarg);
+				Errflag++;
+			}
+			break;
+		case 'j':
+			Stride = strtoull(optarg, NULL, 10);
+			if (Stride < 2 * LANES)
+			{
+				printf("invalid stride = %llu\n", Stride);
+				Errflag++;
+			}
+			Jflag++;
+			break;
+		case 'O':
+			if (strcmp(optarg, "json") == 0)
+				JsonOutput = 1;
+			else if (strcmp(optarg, "csv") != 0)
+			{
+				printf("invalid output format = %s\n", optarg);
+				Errflag++;
+			}
+			break;
 		case 'p':
 			Nthreads = atoi(optarg);
 			if (Nthreads < 1)
@@ -121,11 +340,25 @@ void ProcessCommandLine(int argc, char *argv[])
 			strncpy(RNGStateFile, optarg, 255);
 			Rflag++;
 			break;
+		case 'R':
+			Reproducible++;
+			break;
 		case 's':
 			Sflag++;
 			break;
+		case 'v':
+			for (Sampler = 0; Sampler < NSAMPLERS; Sampler++)
+				if (strcmp(optarg, SamplerNames[Sampler]) == 0)
+					break;
+			if (Sampler == NSAMPLERS)
+			{
+				printf("invalid sampler = %s\n", optarg);
+				Errflag++;
+			}
+			Vflag++;
+			break;
 		case 't':
-			TotalThrows = atoi(optarg);
+			TotalThrows = strtoull(optarg, NULL, 10);
 			if (TotalThrows < 1)
 			{
 				printf("invalid TotalThrows = %llu\n", TotalThrows);
@@ -139,7 +372,19 @@ void ProcessCommandLine(int argc, char *argv[])
 		}
 	}
 	/* ----| Check for manditory arguments and errors ----| */
-	if (!Rflag || Hflag || Errflag)
+	if (Confidence > 0.0 && Target == 0.0)
+		Errflag++;
+	if ((Integrand != NULL || Vflag) && SimdEngine)
+	{
+		printf("-g simd only throws darts\n");
+		Errflag++;
+	}
+	if (Sampler == SOBOL && Target > 0.0)
+	{
+		printf("-v sobol has no running variance for -E\n");
+		Errflag++;
+	}
+	if (Hflag || Errflag)
 	{
 		printf("usage : %s %s\n", argv[0], usage);
 		exit(1);
@@ -158,77 +403,822 @@ long GetMilliseconds(void)
 }
 
 //
-// Throws argument "throws" darts at a unit square (0.0-1.0, 0.0-1.0) and
-// returns the total number of that hit within a quarter circle of unit radius.
+// Lane 0 continues the thread's own stream; each further lane starts
+// Stride/LANES draws after the one before, so the lanes split the
+// thread's stream without overlapping
 //
-void *ThrowDarts(void *thrarg)
+void SeedLanes(struct taus_lanes *tl, gsl_rng *rng)
 {
-	struct thread_arg *myarg;
-	int i;
+	TausState st;
+	unsigned int s1, s2, s3;
+	int l;
+
+	memcpy(&st, gsl_rng_state(rng), sizeof(st));
+	s1 = st.s1;
+	s2 = st.s2;
+	s3 = st.s3;
+	for (l = 0; l < LANES; l++)
+	{
+		if (l > 0)
+			TausJumpWords(&LaneJump, &s1, &s2, &s3);
+		tl->s1[l] = s1;
+		tl->s2[l] = s2;
+		tl->s3[l] = s3;
+	}
+}
+
+//
+// Portable lane engine: "rounds" darts per lane, each lane drawing x then y
+// from its own stream.  Any AVX2 build must count exactly the same hits.
+//
+unsigned long long LaneDartsScalar(struct taus_lanes *tl, unsigned long long rounds)
+{
+	unsigned long long r, hits = 0;
+	unsigned int s1, s2, s3;
+	double u, v;
+	int l;
+
+	for (l = 0; l < LANES; l++)
+	{
+		s1 = tl->s1[l];
+		s2 = tl->s2[l];
+		s3 = tl->s3[l];
+		for (r = 0; r < rounds; r++)
+		{
+			u = TAUS_STEP(s1, s2, s3);
+			v = TAUS_STEP(s1, s2, s3);
+			hits += (SQUARE(u) + SQUARE(v) <= TWO64);
+		}
+		tl->s1[l] = s1;
+		tl->s2[l] = s2;
+		tl->s3[l] = s3;
+	}
+	return hits;
+}
+
+#ifdef HAVE_X86_SIMD
+//
+// All LANES generators advance together, one 256-bit register per state word
+//
+#define TAUS8(s,a,b,c,d) \
+	_mm256_xor_si256(_mm256_slli_epi32(_mm256_and_si256(s, _mm256_set1_epi32(c)), d), \
+	                 _mm256_srli_epi32(_mm256_xor_si256(_mm256_slli_epi32(s, a), s), b))
+
+__attribute__((target("avx2")))
+static inline __m256i Taus8(__m256i *s1, __m256i *s2, __m256i *s3)
+{
+	*s1 = TAUS8(*s1, 13, 19, 0xfffffffe, 12);
+	*s2 = TAUS8(*s2, 2, 25, 0xfffffff8, 4);
+	*s3 = TAUS8(*s3, 3, 11, 0xfffffff0, 17);
+	return _mm256_xor_si256(_mm256_xor_si256(*s1, *s2), *s3);
+}
+
+//
+// Exact unsigned 32-bit to double: flip the sign bit, convert signed, add 2^31
+//
+__attribute__((target("avx2")))
+static inline __m256d U32ToDouble(__m128i u)
+{
+	return _mm256_add_pd(_mm256_cvtepi32_pd(_mm_xor_si128(u, _mm_set1_epi32(0x80000000))),
+	                     _mm256_set1_pd(2147483648.0));
+}
+
+//
+// Quarter-circle test on four darts.  Multiply and add are kept separate
+// (no FMA) so the rounding matches the scalar engine bit for bit.
+//
+__attribute__((target("avx2")))
+static inline __m256i Hits4(__m128i u, __m128i v)
+{
+	__m256d x = U32ToDouble(u), y = U32ToDouble(v);
+	__m256d r = _mm256_add_pd(_mm256_mul_pd(x, x), _mm256_mul_pd(y, y));
+
+	return _mm256_castpd_si256(_mm256_cmp_pd(r, _mm256_set1_pd(TWO64), _CMP_LE_OQ));
+}
+
+__attribute__((target("avx2")))
+unsigned long long LaneDartsAVX2(struct taus_lanes *tl, unsigned long long rounds)
+{
+	__m256i s1 = _mm256_load_si256((__m256i *)tl->s1);
+	__m256i s2 = _mm256_load_si256((__m256i *)tl->s2);
+	__m256i s3 = _mm256_load_si256((__m256i *)tl->s3);
+	__m256i u, v, count = _mm256_setzero_si256();
+	unsigned long long r, c[4];
+
+	for (r = 0; r < rounds; r++)
+	{
+		u = Taus8(&s1, &s2, &s3);
+		v = Taus8(&s1, &s2, &s3);
+		//
+		// a true compare is all ones, i.e. -1, so subtracting counts it
+		//
+		count = _mm256_sub_epi64(count, Hits4(_mm256_castsi256_si128(u), _mm256_castsi256_si128(v)));
+		count = _mm256_sub_epi64(count, Hits4(_mm256_extracti128_si256(u, 1), _mm256_extracti128_si256(v, 1)));
+	}
+	_mm256_store_si256((__m256i *)tl->s1, s1);
+	_mm256_store_si256((__m256i *)tl->s2, s2);
+	_mm256_store_si256((__m256i *)tl->s3, s3);
+	_mm256_storeu_si256((__m256i *)c, count);
+	return c[0] + c[1] + c[2] + c[3];
+}
+#endif
+
+//
+// Lane engine picked once in main() from what the CPU supports
+//
+unsigned long long (*LaneDarts)(struct taus_lanes *, unsigned long long) = LaneDartsScalar;
+
+//
+// Throws "throws" darts on the lane engine: whole rounds of LANES darts,
+// then one dart on each of the first (throws % LANES) lanes
+//
+unsigned long long ThrowDartsSimd(gsl_rng *rng, unsigned long long throws)
+{
+	struct taus_lanes tl;
+	unsigned long long hits;
+	unsigned int s1, s2, s3;
+	double u, v;
+	int l;
+
+	SeedLanes(&tl, rng);
+	hits = LaneDarts(&tl, throws / LANES);
+	for (l = 0; l < throws % LANES; l++)
+	{
+		s1 = tl.s1[l];
+		s2 = tl.s2[l];
+		s3 = tl.s3[l];
+		u = TAUS_STEP(s1, s2, s3);
+		v = TAUS_STEP(s1, s2, s3);
+		hits += (SQUARE(u) + SQUARE(v) <= TWO64);
+	}
+	return hits;
+}
+
+//
+// GSL's scalar path: "throws" darts drawing x then y through gsl_rng_uniform()
+//
+unsigned long long ThrowDartsGsl(gsl_rng *rng, unsigned long long throws)
+{
+	unsigned long long i, hits = 0;
 	double x,y;
-	gsl_rng *myrng;
-	unsigned long long myhits = 0; // our local hit count
+
+	for (i = 0 ; i < throws ; i++)
+	{
+		x = gsl_rng_uniform(rng);
+		y = gsl_rng_uniform(rng);
+		if (SQUARE(x) + SQUARE(y) <= 1.0)
+		{
+			hits++;
+		}
+	}
+	return hits;
+}
+
+//
+// Starting state of stream i
+//
+void StreamState(long long i, TausState *st)
+{
+	unsigned int s1 = StreamBase.s1, s2 = StreamBase.s2, s3 = StreamBase.s3;
+	unsigned long long k;
+	int b;
+
+	if (i < NStates)
+	{
+		memcpy(st, StateMap + i * sizeof(TausState), sizeof(TausState));
+		return;
+	}
+	for (b = 0, k = i - BaseIndex; k; b++, k >>= 1)
+		if (k & 1)
+			TausJumpWords(&StreamJump[b], &s1, &s2, &s3);
+	st->s1 = s1;
+	st->s2 = s2;
+	st->s3 = s3;
+}
+
+//
+// Position "rng" at the start of chunk k
+//
+void ChunkStart(gsl_rng *rng, unsigned long long k)
+{
+	TausState st = ChunkBase;
+	unsigned int s1 = st.s1, s2 = st.s2, s3 = st.s3;
+	int b;
+
+	for (b = 0; k; b++, k >>= 1)
+		if (k & 1)
+			TausJumpWords(&ChunkJump[b], &s1, &s2, &s3);
+	st.s1 = s1;
+	st.s2 = s2;
+	st.s3 = s3;
+	memcpy(gsl_rng_state(rng), &st, sizeof(st));
+}
+
+//
+// n samples of whatever we are estimating, starting at global throw number
+// "first"; darts also report exact hits
+//
+void Sample(gsl_rng *rng, unsigned long long first, unsigned long long n, unsigned long long *hits,
+            double *sum, double *sumsq, double *rsum)
+{
+	if (Integrand != NULL)
+	{
+		Integrand->sample[Sampler](rng, first, n, sum, sumsq, rsum);
+		*hits = 0;
+	}
+	else
+	{
+		*hits = SimdEngine ? ThrowDartsSimd(rng, n) : ThrowDartsGsl(rng, n);
+		*sum = *sumsq = *hits;
+	}
+}
+
+//
+// Make a thread's running totals visible to main()
+//
+void Publish(struct thread_arg *arg, unsigned long long throws, double sum, double sumsq)
+{
+	unsigned s = atomic_load_explicit(&arg->seq, memory_order_relaxed);
+
+	atomic_store_explicit(&arg->seq, s + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	atomic_store_explicit(&arg->pubthrows, throws, memory_order_relaxed);
+	atomic_store_explicit(&arg->pubsum, sum, memory_order_relaxed);
+	atomic_store_explicit(&arg->pubsumsq, sumsq, memory_order_relaxed);
+	atomic_store_explicit(&arg->seq, s + 2, memory_order_release);
+}
+
+//
+// Half-width of "z" standard errors of the estimate Scale * mean(f) from n
+// samples, i.e. Scale * sqrt(var(f) * Group / n).  For darts f is the hit
+// indicator, whose variance is the binomial p(1-p).
+//
+double StandardError(double z, unsigned long long n, double sum, double sumsq)
+{
+	double mean, var;
 
 	//
-	// Extract the arguments passed to us
+	// until f has taken two different values the variance estimate is useless
 	//
-	myarg = (struct thread_arg *)thrarg;
+	if (n < 2)
+		return INFINITY;
+	mean = sum / n;
+	var = sumsq / n - mean * mean;
+	if (var <= 0.0)
+		return INFINITY;
+	return z * Scale * sqrt(var * Group / n);
+}
+
+//
+// Sum what the threads have published so far and return their
+// StandardError()
+//
+double PublishedError(struct thread_arg *thrarg, double z, unsigned long long *n, double *sum, double *sumsq)
+{
+	unsigned long long t;
+	double f, ff;
+	unsigned s;
+	int i;
+
+	*n = 0;
+	*sum = *sumsq = 0.0;
+	for (i = 0; i < Nthreads; i++)
+	{
+		do
+		{
+			s = atomic_load_explicit(&thrarg[i].seq, memory_order_acquire);
+			t = atomic_load_explicit(&thrarg[i].pubthrows, memory_order_relaxed);
+			f = atomic_load_explicit(&thrarg[i].pubsum, memory_order_relaxed);
+			ff = atomic_load_explicit(&thrarg[i].pubsumsq, memory_order_relaxed);
+			atomic_thread_fence(memory_order_acquire);
+		} while ((s & 1) || s != atomic_load_explicit(&thrarg[i].seq, memory_order_relaxed));
+		*n += t;
+		*sum += f;
+		*sumsq += ff;
+	}
+	return StandardError(z, *n, *sum, *sumsq);
+}
+
+//
+// -R: wait until chunk k fits in the window.  Returns 0 if the run has
+// stopped short of it and k is not wanted.
+//
+int WaitForSlot(unsigned long long k)
+{
+	int wanted;
+
+	pthread_mutex_lock(&Order.lock);
+	while (k < Order.limit && k >= Order.folded + ORDER_WINDOW)
+		pthread_cond_wait(&Order.room, &Order.lock);
+	wanted = (k < Order.limit);
+	pthread_mutex_unlock(&Order.lock);
+	return wanted;
+}
+
+//
+// -R: hand in chunk k's result and fold every chunk that is now next in
+// line.  Meeting the -E target on a fold ends the run right there.
+//
+void Fold(unsigned long long k, unsigned long long n, unsigned long long hits, double sum, double sumsq, const double *rsum)
+{
+	struct chunk_result *c;
+	int r;
+
+	pthread_mutex_lock(&Order.lock);
+	if (k < Order.limit)
+	{
+		c = &Order.slot[k % ORDER_WINDOW];
+		c->hits = hits;
+		c->throws = n;
+		c->sum = sum;
+		c->sumsq = sumsq;
+		memcpy(c->rsum, rsum, sizeof(c->rsum));
+		c->ready = 1;
+	}
+	while (Order.folded < Order.limit && (c = &Order.slot[Order.folded % ORDER_WINDOW])->ready)
+	{
+		Order.hits += c->hits;
+		Order.throws += c->throws;
+		Order.sum += c->sum;
+		Order.sumsq += c->sumsq;
+		for (r = 0; r < SOBOL_REPLICATES; r++)
+			Order.rsum[r] += c->rsum[r];
+		c->ready = 0;
+		Order.folded++;
+		if (Target > 0.0 && StandardError(Z, Order.throws, Order.sum, Order.sumsq) <= Target)
+		{
+			Order.limit = Order.folded;
+			atomic_store_explicit(&Work.stop, 1, memory_order_relaxed);
+		}
+	}
+	pthread_cond_broadcast(&Order.room);
+	pthread_mutex_unlock(&Order.lock);
+}
+
+//
+// Throws argument "throws" darts at a unit square (0.0-1.0, 0.0-1.0) and
+// returns the total number of that hit within a quarter circle of unit radius.
+// Since -I, "darts" are samples of whatever is being estimated.
+//
+void DoThrows(struct thread_arg *myarg)
+{
+	unsigned long long k, n, h;
+	TausState mystate __attribute__((aligned(CACHE_LINE)));
+	gsl_rng mygen, *myrng = &mygen;
+	unsigned long long myhits = 0; // our local hit count
+	unsigned long long mythrows = 0, mychunks = 0;
+	double mysum = 0.0, mysumsq = 0.0, f, ff;
+	double rsum[SOBOL_REPLICATES];
 
 	//
 	// Make a local copy of the RNG given to us. Not having a local copy
 	// of this or the hits variable is the reason I was having trouble
 	// getting speedup. Can you figure out why? - bnoble
 	//
-	myrng = gsl_rng_alloc(gsl_rng_taus);
-	gsl_rng_memcpy(myrng, myarg->rng);
+	// The generator is built in place on our own stack, on its own cache
+	// line, straight from the mapped state file or by jumping ahead: no
+	// allocation, and the only thread ever to touch it is this one. In
+	// chunk mode each chunk sets its own state (see ChunkStart()), so our
+	// per-thread stream is only computed for a fixed share.
+	//
+	mygen.type = gsl_rng_taus;
+	mygen.state = &mystate;
 
 	//
-	// Throw them darts
+	// Throw them darts, either our fixed share or chunk after chunk
+	// until none are left
 	//
-	for (i = 0 ; i < myarg->throws ; i++)
+	if (Chunk)
 	{
-		x = gsl_rng_uniform(myrng);
-		y = gsl_rng_uniform(myrng);
-		if (SQUARE(x) + SQUARE(y) <= 1.0)
+		while (!atomic_load_explicit(&Work.stop, memory_order_relaxed) &&
+		       (k = atomic_fetch_add_explicit(&Work.next, 1, memory_order_relaxed)) < Work.nchunks)
 		{
-			myhits++;
+			n = (k == Work.nchunks - 1) ? TotalThrows - k * Chunk : Chunk;
+			if (Reproducible && !WaitForSlot(k))
+				break;
+			ChunkStart(myrng, k);
+			if (Reproducible)
+			{
+				memset(rsum, 0, sizeof(rsum));
+				Sample(myrng, k * Chunk, n, &h, &f, &ff, rsum);
+				Fold(k, n, h, f, ff, rsum);
+			}
+			else
+				Sample(myrng, k * Chunk, n, &h, &f, &ff, myarg->rsum);
+			myhits += h;
+			mysum += f;
+			mysumsq += ff;
+			mythrows += n;
+			mychunks++;
+			if (Target > 0.0 && !Reproducible)
+				Publish(myarg, mythrows, mysum, mysumsq);
 		}
 	}
+	else
+	{
+		StreamState(myarg->id, &mystate);
+		mythrows = myarg->throws;
+		Sample(myrng, myarg->first, mythrows, &myhits, &mysum, &mysumsq, myarg->rsum);
+	}
 	//
 	// Transfer our hit count back to main()'s variable
 	//
 	myarg->hits = myhits;
+	myarg->sum = mysum;
+	myarg->sumsq = mysumsq;
+	myarg->throws = mythrows;
+	myarg->chunks = mychunks;
 
 	//
-	// Signal that we're done and exit the thread
+	// Signal that we're done
 	//
 	pthread_mutex_lock(&Work.lock);
 	Work.count--;
 	if (Work.count == 0)
 		pthread_cond_signal(&Work.done);
 	pthread_mutex_unlock(&Work.lock);
+}
+
+//
+// Thread body for a single run
+//
+void *ThrowDarts(void *thrarg)
+{
+	DoThrows((struct thread_arg *)thrarg);
 	pthread_exit(NULL);
 }
 
+//
+// Thread body for -B: a persistent worker that runs DoThrows() once for
+// every new Work.generation in which its id is below Nthreads
+//
+void *PoolWorker(void *thrarg)
+{
+	struct thread_arg *myarg = (struct thread_arg *)thrarg;
+	unsigned seen = 0;
+	int mine;
+
+	for (;;)
+	{
+		pthread_mutex_lock(&Work.lock);
+		while (Work.generation == seen && !Work.shutdown)
+			pthread_cond_wait(&Work.go, &Work.lock);
+		if (Work.shutdown)
+		{
+			pthread_mutex_unlock(&Work.lock);
+			return NULL;
+		}
+		seen = Work.generation;
+		mine = (myarg->id < Nthreads);
+		pthread_mutex_unlock(&Work.lock);
+		if (mine)
+			DoThrows(myarg);
+	}
+}
+
+//
+// Split TotalThrows between the first Nthreads thread arguments and reset
+// everything a run counts, ready for the threads to start
+//
+void PrepareRun(struct thread_arg *thrarg)
+{
+	int i;
+
+	for (i = 0; i < Nthreads; i++) {
+		thrarg[i].id = i;
+		thrarg[i].throws = TotalThrows / Group / Nthreads * Group;
+		thrarg[i].hits = 0;
+		memset(thrarg[i].rsum, 0, sizeof(thrarg[i].rsum));
+		atomic_init(&thrarg[i].seq, 0);
+		atomic_init(&thrarg[i].pubthrows, 0);
+		atomic_init(&thrarg[i].pubsum, 0.0);
+		atomic_init(&thrarg[i].pubsumsq, 0.0);
+	}
+	//
+	// If throws-per-thread doesn't divide evenly, give the extra to thread 0
+	//
+	thrarg[0].throws += TotalThrows - Nthreads*thrarg[0].throws;
+	for (i = 0; i < Nthreads; i++)
+		thrarg[i].first = (i == 0) ? 0 : thrarg[i-1].first + thrarg[i-1].throws;
+	if (!Chunk && Draws * thrarg[0].throws > Stride)
+		printf("warning: %llu draws per thread overrun the stream stride %llu\n", Draws * thrarg[0].throws, Stride);
+	if (Chunk)
+	{
+		Work.nchunks = (TotalThrows + Chunk - 1) / Chunk;
+		atomic_store(&Work.next, 0);
+	}
+	if (Reproducible)
+	{
+		Order.folded = 0;
+		Order.limit = Work.nchunks;
+		Order.hits = Order.throws = 0;
+		Order.sum = Order.sumsq = 0.0;
+		memset(Order.rsum, 0, sizeof(Order.rsum));
+		for (i = 0; i < ORDER_WINDOW; i++)
+			Order.slot[i].ready = 0;
+	}
+	atomic_store(&Work.stop, 0);
+	Work.count = Nthreads;
+}
+
+//
+// main() waits until all of the threads are done
+//
+// How this works:
+//   1. Acquire the mutex lock
+//   2. pthread_cond_wait releases the mutex lock and blocks main() until
+//      the condition variable Work.done is true. When condition Work.done
+//      is true, main() resumes having reacquired the mutex lock
+//   3. If Work.count is 0, all threads are done so main() releases Work.lock
+//
+// This approach is called Barrier Synchronization.  With -E the wait
+// times out every POLL_MS so main() can check the published totals
+// and tell the threads to stop after their current chunk (under -R the
+// threads check the target themselves as they fold).
+//
+void WaitForThreads(struct thread_arg *thrarg)
+{
+	struct timespec deadline;
+	unsigned long long n;
+	double sum, sumsq;
+
+	pthread_mutex_lock(&Work.lock);
+	while (Work.count > 0)
+	{
+		if (Target > 0.0 && !Reproducible && !atomic_load_explicit(&Work.stop, memory_order_relaxed))
+		{
+			clock_gettime(CLOCK_REALTIME, &deadline);
+			deadline.tv_nsec += POLL_MS * 1000000L;
+			if (deadline.tv_nsec >= 1000000000L)
+			{
+				deadline.tv_sec++;
+				deadline.tv_nsec -= 1000000000L;
+			}
+			pthread_cond_timedwait(&Work.done, &Work.lock, &deadline);
+			if (PublishedError(thrarg, Z, &n, &sum, &sumsq) <= Target)
+				atomic_store_explicit(&Work.stop, 1, memory_order_relaxed);
+		}
+		else
+			pthread_cond_wait(&Work.done, &Work.lock);
+	}
+	pthread_mutex_unlock(&Work.lock);
+}
+
+//
+// Outcome of one run, from the throws actually made
+//
+struct result
+{
+	unsigned long long throws;
+	unsigned long long hits;
+	double estimate;
+	double error;	// Z standard errors
+};
+
+void Collect(struct thread_arg *thrarg, struct result *res)
+{
+	double sum, sumsq, mean, dev;
+	int i, r;
+
+	//
+	// -R takes the folded chunks, in order; otherwise the threads' totals
+	//
+	if (Reproducible)
+	{
+		res->hits = Order.hits;
+		res->throws = Order.throws;
+		sum = Order.sum;
+		res->error = StandardError(Z, Order.throws, Order.sum, Order.sumsq);
+	}
+	else
+	{
+		res->hits = 0;
+		for (i = 0; i < Nthreads; i++)
+		{
+			res->hits += thrarg[i].hits;
+			Publish(&thrarg[i], thrarg[i].throws, thrarg[i].sum, thrarg[i].sumsq);
+		}
+		res->error = PublishedError(thrarg, Z, &res->throws, &sum, &sumsq);
+	}
+	res->estimate = Scale * sum / res->throws;
+	//
+	// Sobol: the replicates are independent estimates, so the error is the
+	// standard deviation of their means over sqrt(replicates)
+	//
+	if (Sampler == SOBOL)
+	{
+		dev = 0.0;
+		for (r = 0; r < SOBOL_REPLICATES; r++)
+		{
+			if (Reproducible)
+				mean = Order.rsum[r];
+			else
+				for (mean = 0.0, i = 0; i < Nthreads; i++)
+					mean += thrarg[i].rsum[r];
+			mean = Scale * mean / (res->throws / SOBOL_REPLICATES);
+			dev += SQUARE(mean - res->estimate);
+		}
+		res->error = sqrt(dev / (SOBOL_REPLICATES - 1) / SOBOL_REPLICATES);
+	}
+}
+
+//
+// Throws rounded up to whole sampler groups
+//
+unsigned long long WholeGroups(unsigned long long throws)
+{
+	return (throws % Group == 0) ? throws : throws + Group - throws % Group;
+}
+
+//
+// -B: run every job of the job file on one pool of threads, one result line
+// per run.  A job line is "throws threads [repeats]" where threads may be a
+// range lo-hi; '#' starts a comment.  Each repeat sweeps the whole thread
+// range before the next begins, spreading drift across thread counts.
+//
+void RunBatch(FILE *outfp)
+{
+	struct job { unsigned long long throws; int lo, hi, repeats; } *jobs = NULL;
+	struct thread_arg *thrarg;
+	struct result res;
+	pthread_t *threads;
+	FILE *fp;
+	char line[256], *p;
+	int njobs = 0, maxjobs = 0, poolsize = 1, j, t, r, lineno = 0;
+	long stime, etime;
+
+	if (strcmp(JobFile, "-") == 0)
+		fp = stdin;
+	else if ((fp = fopen(JobFile, "r")) == NULL)
+	{
+		printf("Cannot open %s for reading: %s\n", JobFile, strerror(errno));
+		exit(3);
+	}
+	while (fgets(line, sizeof(line), fp) != NULL)
+	{
+		lineno++;
+		if ((p = strchr(line, '#')) != NULL)
+			*p = '\0';
+		if (strspn(line, " \t\r\n") == strlen(line))
+			continue;
+		if (njobs == maxjobs)
+			jobs = realloc(jobs, (maxjobs = 2 * maxjobs + 8) * sizeof(*jobs));
+		jobs[njobs].throws = (unsigned long long)strtod(line, &p);
+		jobs[njobs].lo = jobs[njobs].hi = strtol(p, &p, 10);
+		if (*p == '-')
+			jobs[njobs].hi = strtol(p + 1, &p, 10);
+		jobs[njobs].repeats = strtol(p, &p, 10);
+		if (jobs[njobs].repeats == 0)
+			jobs[njobs].repeats = 1;
+		if (jobs[njobs].throws < 1 || jobs[njobs].lo < 1 || jobs[njobs].hi < jobs[njobs].lo || jobs[njobs].repeats < 1)
+		{
+			printf("%s:%d: expected \"throws threads[-threads] [repeats]\"\n", JobFile, lineno);
+			exit(1);
+		}
+		//
+		// Same group rounding and Sobol cap as a single run, per job
+		//
+		if (jobs[njobs].throws % Group != 0)
+		{
+			jobs[njobs].throws = WholeGroups(jobs[njobs].throws);
+			printf("note: %s:%d: %s sampling uses groups of %llu throws, running %llu\n", JobFile, lineno,
+			       SamplerNames[Sampler], Group, jobs[njobs].throws);
+		}
+		if (Sampler == SOBOL && jobs[njobs].throws / SOBOL_REPLICATES >= 4294967295ULL)
+		{
+			printf("%s:%d: -v sobol supports at most %llu throws\n", JobFile, lineno, 4294967295ULL * SOBOL_REPLICATES);
+			exit(1);
+		}
+		if (jobs[njobs].hi > poolsize)
+			poolsize = jobs[njobs].hi;
+		njobs++;
+	}
+	if (fp != stdin)
+		fclose(fp);
+
+	//
+	// One pool sized for the largest job; smaller jobs use its first threads
+	//
+	threads = (pthread_t *)malloc(poolsize * sizeof(pthread_t));
+	if (posix_memalign((void **)&thrarg, CACHE_LINE, poolsize * sizeof(struct thread_arg)) != 0)
+	{
+		printf("Cannot allocate thread arguments\n");
+		exit(5);
+	}
+	for (t = 0; t < poolsize; t++)
+	{
+		thrarg[t].id = t;
+		pthread_create(&threads[t], NULL, PoolWorker, &thrarg[t]);
+	}
+
+	if (!JsonOutput)
+		fprintf(outfp, "job,threads,repeat,throws,milliseconds,estimate,stderr,error\n");
+	for (j = 0; j < njobs; j++)
+	{
+		for (r = 1; r <= jobs[j].repeats; r++)
+		{
+			for (t = jobs[j].lo; t <= jobs[j].hi; t++)
+			{
+				Nthreads = t;
+				TotalThrows = jobs[j].throws;
+				PrepareRun(thrarg);
+				stime = GetMilliseconds();
+				pthread_mutex_lock(&Work.lock);
+				Work.generation++;
+				pthread_cond_broadcast(&Work.go);
+				pthread_mutex_unlock(&Work.lock);
+				WaitForThreads(thrarg);
+				etime = GetMilliseconds();
+				Collect(thrarg, &res);
+				if (JsonOutput)
+					fprintf(outfp, "{\"job\": %d, \"threads\": %d, \"repeat\": %d, \"throws\": %llu, \"milliseconds\": %ld, "
+					        "\"estimate\": %.15f, \"stderr\": %.6g, \"error\": %.15f}\n", j + 1, t, r, res.throws,
+					        etime - stime, res.estimate, res.error, Exact - res.estimate);
+				else
+					fprintf(outfp, "%d,%d,%d,%llu,%ld,%.15f,%.6g,%.15f\n", j + 1, t, r, res.throws,
+					        etime - stime, res.estimate, res.error, Exact - res.estimate);
+				fflush(outfp);
+			}
+		}
+	}
+
+	pthread_mutex_lock(&Work.lock);
+	Work.shutdown = 1;
+	pthread_cond_broadcast(&Work.go);
+	pthread_mutex_unlock(&Work.lock);
+	for (t = 0; t < poolsize; t++)
+		pthread_join(threads[t], NULL);
+	free(jobs);
+	free(threads);
+	free(thrarg);
+}
+
 //
 // Start the show
 //
 int main(int argc, char *argv[])
 {
-	FILE *rngfp;
+	struct statefile_header hdr;
+	void *map = NULL;
+	size_t maplen = 0;
+	gsl_rng gen;
 	FILE *outfp;
 	pthread_t *threads;
 #ifdef BOUND_THREADS
 	pthread_attr_t tattr;
 #endif
 	struct thread_arg *thrarg;
-	double estpi = 0;
-	unsigned long long sumhits = 0;
+	struct result res;
+	double estpi = 0, seconds;
 	long stime, etime;
 	int i;
 	time_t tloc;
 
+	IntegrandsInit();
 	ProcessCommandLine(argc, argv);
+	if (Vflag && Integrand == NULL)
+		Integrand = FindIntegrand("pi");
+	if (Integrand != NULL)
+	{
+		Draws = Integrand->dim;
+		Scale = pow(Integrand->hi - Integrand->lo, Integrand->dim);
+		Group = SamplerGroup(Sampler, Integrand->dim);
+		Exact = Integrand->exact;
+	}
+	//
+	// Early stopping and -R work chunk by chunk; -t, if given, caps the run
+	//
+	if (Reproducible && !Chunk)
+		Chunk = DEFAULT_CHUNK;
+	if (Target > 0.0)
+	{
+		if (!Chunk)
+			Chunk = DEFAULT_CHUNK;
+		if (!Tflag)
+			TotalThrows = MAX_TARGET_THROWS;
+		if (Confidence > 0.0)
+			Z = gsl_cdf_ugaussian_Pinv(0.5 + Confidence / 2.0);
+	}
+	//
+	// Whole groups only: round the throws and the chunk up to a multiple.
+	// -B rounds and checks each job's throws as it reads them instead.
+	//
+	if (!Bflag && TotalThrows % Group != 0)
+	{
+		TotalThrows = WholeGroups(TotalThrows);
+		printf("note: %s sampling uses groups of %llu throws, running %llu\n", SamplerNames[Sampler], Group, TotalThrows);
+	}
+	if (Chunk % Group != 0)
+		Chunk += Group - Chunk % Group;
+	if (!Bflag && Sampler == SOBOL && TotalThrows / SOBOL_REPLICATES >= 4294967295ULL)
+	{
+		printf("-v sobol supports at most %llu throws\n", 4294967295ULL * SOBOL_REPLICATES);
+		exit(1);
+	}
+#ifdef HAVE_X86_SIMD
+	if (__builtin_cpu_supports("avx2"))
+		LaneDarts = LaneDartsAVX2;
+#endif
 
 	//
 	// Send output to either a file or stdout
@@ -251,13 +1241,9 @@ int main(int argc, char *argv[])
 	//
 	pthread_mutex_init(&Work.lock, NULL);
 	pthread_cond_init(&Work.done, NULL);
-
-	//
-	// Initialize the other stuff
-	//
-	Work.count = Nthreads;
-	threads = (pthread_t *)malloc(Nthreads * sizeof(pthread_t));
-	thrarg = (struct thread_arg *)malloc(Nthreads * sizeof(struct thread_arg));
+	pthread_cond_init(&Work.go, NULL);
+	pthread_mutex_init(&Order.lock, NULL);
+	pthread_cond_init(&Order.room, NULL);
 
 	//
 	// Print wall-clock summary if requested
@@ -269,35 +1255,99 @@ int main(int argc, char *argv[])
 	}
 
 	//
-	// Open the GSL RNG state save file
+	// Map the GSL RNG state save file, if there is one.  A versioned file
+	// is checked against its header and supplies the stride; a legacy one
+	// is taken on trust.
 	//
-	if ((rngfp = fopen(RNGStateFile, "rb")) == NULL)
+	if (gsl_rng_taus->size != sizeof(TausState))
 	{
-		printf("Cannot open %s for reading: %s\n", RNGStateFile, strerror(errno));
-		exit(3);
+		printf("unexpected taus state size %u\n", (unsigned int)gsl_rng_taus->size);
+		exit(4);
 	}
-	//
-	// Initialize the thread arguments
-	//
-	for (i = 0; i < Nthreads; i++) {
-		thrarg[i].id = i;
-		thrarg[i].throws = TotalThrows/Nthreads;
-		thrarg[i].hits = 0;
-		thrarg[i].rng = gsl_rng_alloc(gsl_rng_taus);
-		if (gsl_rng_fread(rngfp,thrarg[i].rng) != 0) {
-			printf("thrarg[%d]: gsl_rng_fread() failed\n",i);
+	if (Rflag)
+	{
+		NStates = StateFileMap(RNGStateFile, gsl_rng_taus->name, sizeof(TausState), &StateMap, &map, &maplen, &hdr);
+		if (NStates < 0)
+			exit(3);
+		if (NStates == 0)
+		{
+			printf("%s: no usable RNG states\n", RNGStateFile);
 			exit(4);
 		}
+		if (hdr.version != 0 && !Jflag)
+			Stride = hdr.stride;
+		else if (hdr.version != 0 && Stride != hdr.stride)
+			printf("warning: -j %llu differs from the %llu stride of %s\n", Stride, (unsigned long long)hdr.stride, RNGStateFile);
+		if (Dflag && NStates < Nthreads)
+			printf("%s holds %lld states, jumping ahead for the rest\n", RNGStateFile, NStates);
 	}
 	//
-	// If throws-per-thread doesn't divide evenly, give the extra to thread 0
+	// Set up the streams.  Starting states come from the file while it
+	// lasts; every later stream is the one before jumped ahead by Stride
+	// draws, and without a file the first is seeded with -e.  The threads
+	// build their own generators from these (see StreamState()).
 	//
-	thrarg[0].throws += TotalThrows - Nthreads*thrarg[0].throws;
+	gen.type = gsl_rng_taus;
+	gen.state = &StreamBase;
+	if (NStates > 0)
+	{
+		BaseIndex = NStates - 1;
+		memcpy(&StreamBase, StateMap + BaseIndex * sizeof(TausState), sizeof(TausState));
+	}
+	else
+		gsl_rng_set(&gen, Eflag ? Seed : gsl_rng_default_seed);
+	TausJumpInit(&StreamJump[0], Stride);
+	for (i = 1; i < 64; i++)
+		TausJumpCompose(&StreamJump[i], &StreamJump[i-1], &StreamJump[i-1]);
+	TausJumpInit(&LaneJump, (Chunk ? 2 * Chunk : Stride) / LANES);
 
 	//
-	// Close the GSL RNG state save file
+	// Sobol's random shifts come from the first stream; its points use no
+	// other draws
 	//
-	fclose(rngfp);
+	if (Sampler == SOBOL)
+	{
+		TausState shiftstate;
+
+		StreamState(0, &shiftstate);
+		gen.state = &shiftstate;
+		SobolInit(&gen);
+	}
+
+	//
+	// Chunks all come out of the first stream
+	//
+	if (Chunk)
+	{
+		StreamState(0, &ChunkBase);
+		TausJumpInit(&ChunkJump[0], Draws * Chunk);
+		for (i = 1; i < 64; i++)
+			TausJumpCompose(&ChunkJump[i], &ChunkJump[i-1], &ChunkJump[i-1]);
+	}
+
+	//
+	// A job file replaces the single run below
+	//
+	if (Bflag)
+	{
+		RunBatch(outfp);
+		if (map != NULL)
+			munmap(map, maplen);
+		if (Fflag)
+			fclose(outfp);
+		exit(0);
+	}
+
+	//
+	// Initialize the other stuff
+	//
+	threads = (pthread_t *)malloc(Nthreads * sizeof(pthread_t));
+	if (posix_memalign((void **)&thrarg, CACHE_LINE, Nthreads * sizeof(struct thread_arg)) != 0)
+	{
+		printf("Cannot allocate thread arguments\n");
+		exit(5);
+	}
+	PrepareRun(thrarg);
 
 	//
 	// Begin timing - Always compute the starting and ending time.
@@ -322,22 +1372,7 @@ int main(int argc, char *argv[])
 #endif
 	}
 
-	//
-	// main() waits until all of the threads are done
-	//
-	// How this works:
-	//   1. Acquire the mutex lock
-	//   2. pthread_cond_wait releases the mutex lock and blocks main() until
- 	//      the condition variable Work.done is true. When condition Work.done
- 	//      is true, main() resumes having reacquired the mutex lock
-	//   3. If Work.count is 0, all threads are done so main() releases Work.lock
-	//
-	// This approach is called Barrier Synchronization
-	//
-	pthread_mutex_lock(&Work.lock);
-	while (Work.count > 0)
-		pthread_cond_wait(&Work.done, &Work.lock);
-	pthread_mutex_unlock(&Work.lock);
+	WaitForThreads(thrarg);
 
 	//
 	// End timing - See the note above about overhead
@@ -346,15 +1381,40 @@ int main(int argc, char *argv[])
 	fprintf(outfp, "%ld milliseconds\n", etime - stime);
 
 	//
-	// Compute our estimate of pi
+	// Compute our estimate from the throws actually made
 	//
-	if (Dflag) {
-		sumhits = 0;
-		for (i = 0; i < Nthreads; i++)
-			sumhits += thrarg[i].hits;
-		estpi = 4.0 * (double)sumhits / (double)TotalThrows;
-		fprintf(outfp, "%llu/%-llu = %.15f : error %.15f\n", sumhits, TotalThrows, estpi, M_PI-estpi);
+	Collect(thrarg, &res);
+	//
+	// -v figure of merit: variance reduction is worth it when it buys more
+	// accuracy than it costs in time, i.e. when 1/(error^2 * seconds) grows
+	//
+	if (Vflag)
+	{
+		seconds = (etime - stime) / 1000.0;
+		fprintf(outfp, "%s: standard error %.3g, efficiency %.4g (1/(error^2 * seconds))\n",
+		        SamplerNames[Sampler], res.error, 1.0 / (SQUARE(res.error) * ((seconds > 0.0) ? seconds : 0.001)));
 	}
+	if (Target > 0.0)
+	{
+		fprintf(outfp, "%s after %llu throws: %s = %.15f +/- %.3g", (res.error <= Target) ? "converged" : "budget exhausted",
+		        res.throws, Integrand ? Integrand->name : "pi", res.estimate, res.error);
+		if (Confidence > 0.0)
+			fprintf(outfp, " (%g%% confidence)", 100.0 * Confidence);
+		fprintf(outfp, "\n");
+	}
+	else if (Integrand != NULL)
+	{
+		fprintf(outfp, "%s = %.15f +/- %.3g : error %.15f\n", Integrand->name, res.estimate, res.error, Exact - res.estimate);
+	}
+	if (Dflag && Integrand == NULL) {
+		estpi = 4.0 * (double)res.hits / (double)res.throws;
+		fprintf(outfp, "%llu/%-llu = %.15f : error %.15f\n", res.hits, res.throws, estpi, M_PI-estpi);
+		for (i = 0; Chunk && i < Nthreads; i++)
+			fprintf(outfp, "thread %d: %llu chunks, %llu throws\n", i, thrarg[i].chunks, thrarg[i].throws);
+	}
+
+	if (map != NULL)
+		munmap(map, maplen);
 
 	//
 	// If the output was saved to a file, close it now.
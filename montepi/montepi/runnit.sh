@@ -1,8 +1,8 @@
 #!/bin/bash
-for j in `seq 1 10`;
-do
-    for i in `seq 1 32`;
-    do
-        script -atf -q -c "./montepi -t 1 -r taus_rng_64_states_with_stride_20000000000.dat -t 1000000000 -p ${i}" $1
-    done
-done
+#
+# 10 repeats of 1e9 throws on 1..32 threads, all in one montepi process.
+# One CSV line per run (job,threads,repeat,throws,milliseconds,...) goes
+# to $1, results.csv by default.  -R makes every estimate bit-identical,
+# so the speedups and the correctness of the scaling runs are checked at once.
+#
+echo "1000000000 1-32 10" | ./montepi -r taus_rng_64_states_with_stride_20000000000.dat -R -B - -f ${1:-results.csv}
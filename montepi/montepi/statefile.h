@@ -0,0 +1,151 @@
+//
+// statefile.h
+//
+// RNG state files shared by gsl_rng_save_states and montepi.
+//
+// A versioned file starts with struct statefile_header, followed by "count"
+// raw generator states of "state_size" bytes each (what gsl_rng_fwrite()
+// writes), consecutive states being "stride" draws apart.  The checksum is
+// 64-bit FNV-1a over the state bytes.  Fields are in host byte order.
+//
+// Files written before the header existed are bare gsl_rng_fwrite() states
+// and are still accepted, without any of the checks.
+//
+
+#ifndef STATEFILE_H
+#define STATEFILE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define STATEFILE_MAGIC "RNGSTATE"
+#define STATEFILE_VERSION 1
+
+struct statefile_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t state_size;
+	char generator[16];	// gsl_rng_name(), NUL padded
+	uint64_t stride;
+	uint64_t count;
+	uint64_t checksum;
+};
+
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+static inline uint64_t Fnv1a(const void *data, size_t len, uint64_t h)
+{
+	const unsigned char *p = data;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+	{
+		h ^= p[i];
+		h *= FNV_PRIME;
+	}
+	return h;
+}
+
+static inline void StateHeaderInit(struct statefile_header *hdr, const char *generator, size_t state_size,
+                                   unsigned long long stride, unsigned long long count, const void *states)
+{
+	memset(hdr, 0, sizeof(*hdr));
+	memcpy(hdr->magic, STATEFILE_MAGIC, sizeof(hdr->magic));
+	hdr->version = STATEFILE_VERSION;
+	hdr->state_size = state_size;
+	strncpy(hdr->generator, generator, sizeof(hdr->generator) - 1);
+	hdr->stride = stride;
+	hdr->count = count;
+	hdr->checksum = Fnv1a(states, count * state_size, FNV_OFFSET);
+}
+
+//
+// Check a header read from "file" against the generator we expect and the
+// states that follow it.  Prints what is wrong and returns -1, else 0.
+//
+static inline int StateHeaderCheck(const struct statefile_header *hdr, const char *file, const char *generator,
+                                   size_t state_size, const void *states, size_t bytes)
+{
+	if (hdr->version != STATEFILE_VERSION)
+	{
+		printf("%s: unsupported state file version %u\n", file, hdr->version);
+		return -1;
+	}
+	if (strncmp(hdr->generator, generator, sizeof(hdr->generator)) != 0 || hdr->state_size != state_size)
+	{
+		printf("%s: holds %.16s states of %u bytes, expected %s states of %u bytes\n", file,
+		       hdr->generator, hdr->state_size, generator, (unsigned)state_size);
+		return -1;
+	}
+	// compare by division: count * state_size can wrap for a corrupt count
+	if (hdr->count > bytes / state_size)
+	{
+		printf("%s: truncated, %llu of %llu states present\n", file,
+		       (unsigned long long)(bytes / state_size), (unsigned long long)hdr->count);
+		return -1;
+	}
+	if (Fnv1a(states, hdr->count * state_size, FNV_OFFSET) != hdr->checksum)
+	{
+		printf("%s: checksum mismatch\n", file);
+		return -1;
+	}
+	return 0;
+}
+
+//
+// Map "file" read-only and point *states at its first state; the mapping
+// (*map, *maplen) stays valid until the caller munmap()s it.  hdr->version
+// is 0 for a legacy file without a header.  Returns the number of states,
+// or -1 after printing the problem.
+//
+static inline long long StateFileMap(const char *file, const char *generator, size_t state_size,
+                                     const char **states, void **map, size_t *maplen, struct statefile_header *hdr)
+{
+	struct stat sb;
+	char *base;
+	int fd;
+
+	memset(hdr, 0, sizeof(*hdr));
+	*map = NULL;
+	*maplen = 0;
+	if ((fd = open(file, O_RDONLY)) < 0 || fstat(fd, &sb) != 0)
+	{
+		printf("Cannot open %s for reading: %s\n", file, strerror(errno));
+		return -1;
+	}
+	if (sb.st_size == 0)
+	{
+		close(fd);
+		return 0;
+	}
+	base = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED)
+	{
+		printf("Cannot map %s: %s\n", file, strerror(errno));
+		return -1;
+	}
+	*map = base;
+	*maplen = sb.st_size;
+	if (sb.st_size >= sizeof(*hdr) && memcmp(base, STATEFILE_MAGIC, sizeof(hdr->magic)) == 0)
+	{
+		memcpy(hdr, base, sizeof(*hdr));
+		*states = base + sizeof(*hdr);
+		if (StateHeaderCheck(hdr, file, generator, state_size, *states, sb.st_size - sizeof(*hdr)) != 0)
+			return -1;
+		return hdr->count;
+	}
+	*states = base;
+	return sb.st_size / state_size;
+}
+
+#endif
@@ -0,0 +1,156 @@
+//
+// taus.h
+//
+// Helpers for GSL's taus generator shared by montepi and gsl_rng_save_states:
+// the raw 32-bit recurrence and jump-ahead over GF(2).
+//
+// Each of the three taus components is a linear map M on a 32-bit word, so
+// n steps are M^n, computed by repeated squaring as a 32x32 bit matrix.
+// A jump of any distance costs at most 64 squarings per component, i.e.
+// microseconds, instead of n calls to gsl_rng_get().
+//
+
+#ifndef TAUS_H
+#define TAUS_H
+
+#include <string.h>
+#include <gsl/gsl_rng.h>
+
+//
+// Layout of GSL's (private) taus state, so a gsl_rng can be read and
+// written through gsl_rng_state()
+//
+typedef struct
+{
+	unsigned long s1, s2, s3;
+} TausState;
+
+//
+// One taus step on 32-bit state words; the same recurrence as GSL's
+// TAUSWORTHE() with the 0xffffffff masks implied by the word size
+//
+#define TAUS(s,a,b,c,d) ((((s) & (c)) << (d)) ^ ((((s) << (a)) ^ (s)) >> (b)))
+#define TAUS1(s) TAUS(s, 13, 19, 4294967294U, 12)
+#define TAUS2(s) TAUS(s, 2, 25, 4294967288U, 4)
+#define TAUS3(s) TAUS(s, 3, 11, 4294967280U, 17)
+#define TAUS_STEP(s1,s2,s3) \
+	((s1) = TAUS1(s1), (s2) = TAUS2(s2), (s3) = TAUS3(s3), (s1) ^ (s2) ^ (s3))
+
+//
+// A 32x32 matrix over GF(2) stored by columns: col[i] is the image of bit i
+//
+struct taus_matrix
+{
+	unsigned int col[32];
+};
+
+//
+// Jump of a fixed distance, one matrix per component
+//
+struct taus_jump
+{
+	unsigned long long distance;
+	struct taus_matrix m[3];
+};
+
+static inline unsigned int TausMatrixApply(const struct taus_matrix *m, unsigned int v)
+{
+	unsigned int r = 0;
+	int i;
+
+	for (i = 0; v; i++, v >>= 1)
+		if (v & 1)
+			r ^= m->col[i];
+	return r;
+}
+
+//
+// p = a * b (apply b first); p may alias neither a nor b
+//
+static inline void TausMatrixMultiply(struct taus_matrix *p, const struct taus_matrix *a, const struct taus_matrix *b)
+{
+	int i;
+
+	for (i = 0; i < 32; i++)
+		p->col[i] = TausMatrixApply(a, b->col[i]);
+}
+
+//
+// Build the matrices that advance a taus state by "distance" steps
+//
+static inline void TausJumpInit(struct taus_jump *j, unsigned long long distance)
+{
+	struct taus_matrix pow, tmp;
+	unsigned long long n;
+	unsigned int e;
+	int c, i;
+
+	j->distance = distance;
+	for (c = 0; c < 3; c++)
+	{
+		for (i = 0; i < 32; i++)
+		{
+			e = 1U << i;
+			pow.col[i] = (c == 0) ? TAUS1(e) : (c == 1) ? TAUS2(e) : TAUS3(e);
+			j->m[c].col[i] = e;
+		}
+		for (n = distance; n; n >>= 1)
+		{
+			if (n & 1)
+			{
+				TausMatrixMultiply(&tmp, &pow, &j->m[c]);
+				j->m[c] = tmp;
+			}
+			TausMatrixMultiply(&tmp, &pow, &pow);
+			pow = tmp;
+		}
+	}
+}
+
+//
+// p = the jump of distance a->distance + b->distance; p may alias a or b
+//
+static inline void TausJumpCompose(struct taus_jump *p, const struct taus_jump *a, const struct taus_jump *b)
+{
+	struct taus_matrix tmp;
+	int c;
+
+	for (c = 0; c < 3; c++)
+	{
+		TausMatrixMultiply(&tmp, &a->m[c], &b->m[c]);
+		p->m[c] = tmp;
+	}
+	p->distance = a->distance + b->distance;
+}
+
+//
+// Advance raw state words in place
+//
+static inline void TausJumpWords(const struct taus_jump *j, unsigned int *s1, unsigned int *s2, unsigned int *s3)
+{
+	*s1 = TausMatrixApply(&j->m[0], *s1);
+	*s2 = TausMatrixApply(&j->m[1], *s2);
+	*s3 = TausMatrixApply(&j->m[2], *s3);
+}
+
+//
+// Advance a gsl_rng_taus generator in place, exactly as "distance" calls
+// to gsl_rng_get() would
+//
+static inline void TausJumpRng(const struct taus_jump *j, gsl_rng *rng)
+{
+	TausState st;
+	unsigned int s1, s2, s3;
+
+	memcpy(&st, gsl_rng_state(rng), sizeof(st));
+	s1 = st.s1;
+	s2 = st.s2;
+	s3 = st.s3;
+	TausJumpWords(j, &s1, &s2, &s3);
+	st.s1 = s1;
+	st.s2 = s2;
+	st.s3 = s3;
+	memcpy(gsl_rng_state(rng), &st, sizeof(st));
+}
+
+#endif